@@ -11,12 +11,52 @@
 #include <map>
 #include <limits>
 #include <algorithm> // Added for sort function
+#include <random>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#define METRICS_HTTP_SUPPORTED
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#define MMAP_SUPPORTED
+#endif
+#ifdef __linux__
+#define PERF_COUNTERS_SUPPORTED
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "material_identifier.h"
 
 using namespace std;
 
 // Constants
 const double epsilon_0 = 8.85e-12; // F/m (Permittivity of free space) - corrected value
 // Converting to pF/mm: 8.85e-12 F/m = 8.85e-3 pF/mm
+const double electron_charge = 1.602176634e-19; // C
+const double pi = 3.14159265358979323846;
+const double boltzmann_eV = 8.617333262e-5; // eV/K
 
 // Sample structure
 struct Sample {
@@ -27,6 +67,669 @@ struct Sample {
     vector<pair<int, double>> temp_capacitance_data;
 };
 
+// Early Curie temperature prediction (see predictCurieTemperature)
+struct CuriePrediction {
+    bool peak_passed;          // enough readings past the maximum to trust it
+    bool can_stop;             // prediction is confident enough to end the sweep
+    int points_after_peak;
+    double peak_temp_C;        // hottest-ε reading
+    double predicted_curie_C;  // parabolic refinement of the peak
+    double uncertainty_C;      // 1-sigma estimate of predicted_curie_C
+    double curie_weiss_T0_C;   // extrapolated Curie-Weiss temperature
+    double curie_constant;     // C in ε = C / (T - T0), in K
+    double fit_r2;             // goodness of the Curie-Weiss fit above the peak
+};
+
+// Settings for when a sweep may be stopped early
+const int early_stop_min_points = 3;       // readings needed above the peak
+const double early_stop_min_drop = 0.05;   // ε must fall 5% below the peak
+const double early_stop_min_r2 = 0.95;     // Curie-Weiss fit quality
+const double early_stop_tolerance_C = 1.0; // allowed 1-sigma uncertainty...
+const double early_stop_tolerance_steps = 0.5; // ...or half the reading step, if wider
+
+// Multiplexed oven run: a scanner switches one meter between up to 64 samples,
+// so a single acquisition stream carries interleaved readings tagged by channel.
+const int max_mux_channels = 64;
+
+struct MuxReading {
+    int channel;
+    int temp;
+    double capacitance;
+};
+
+struct MultiplexedRun {
+    map<int, string> channel_materials; // channel id -> material name
+    vector<MuxReading> readings;        // in acquisition order
+};
+
+// Van der Pauw measurement on an arbitrarily shaped wafer piece, in the standard
+// eight-configuration order. Contacts 1-4 run counter-clockwise around the edge;
+// R[i] is V(jk)/I(mn) for configuration i, V_hall are the diagonal voltages.
+struct VanDerPauwMeasurement {
+    string sample_id;
+    double thickness_mm;
+    double current_A;
+    double field_T;
+    double R[8];      // R21,34 R12,43 R32,41 R23,14 R43,12 R34,21 R14,23 R41,32 (Ω)
+    double V_hall[8]; // V24 V42 V13 V31 at +B, then the same at -B (V)
+};
+
+struct HallResult {
+    string sample_id;
+    double sheet_resistance; // Ω/sq
+    double resistivity;      // Ω·cm
+    double hall_coefficient; // cm³/C, positive for holes
+    double sheet_density;    // cm⁻²
+    double carrier_density;  // cm⁻³
+    double mobility;         // cm²/(V·s)
+    bool converged;          // van der Pauw iteration reached tolerance
+};
+
+// Hall coefficient measured across temperature on one sample, kept sorted by
+// temperature like Sample::temp_capacitance_data
+struct HallSweep {
+    string sample_id;
+    vector<pair<double, double>> temp_hall_data; // (T in K, R_H in cm³/C)
+};
+
+// REGIME_ANOMALOUS marks a density that falls as the sample warms, which no single-band
+// regime explains (mixed conduction or a measurement fault); it is reported but not fitted
+enum ConductionRegime { REGIME_FREEZE_OUT, REGIME_EXTRINSIC, REGIME_INTRINSIC, REGIME_ANOMALOUS };
+
+// A straight-line region of ln n against 1000/T
+struct ArrheniusSegment {
+    ConductionRegime regime;
+    size_t first, last;   // reading indices, inclusive
+    double activation_eV; // from the slope of ln n vs 1/T
+};
+
+struct HallSweepResult {
+    string sample_id;
+    vector<double> inverse_temp;    // 1000/T (1/K), one per reading
+    vector<double> carrier_density; // cm⁻³, one per reading
+    vector<ArrheniusSegment> segments;
+    double band_gap_eV;             // 0 if the intrinsic region was not reached
+    double ionization_eV;           // dopant level from freeze-out, 0 if not reached
+    double saturation_density;      // cm⁻³ in the extrinsic region, 0 if absent
+    bool holes;                     // majority carrier sign below the intrinsic region
+};
+
+// Regime thresholds on the apparent activation energy of ln n vs 1/T
+const double extrinsic_max_activation_eV = 0.01;  // flatter than this: all dopants ionised
+const double freeze_out_max_activation_eV = 0.15; // steeper than this: across the gap
+const size_t min_arrhenius_points = 3;
+
+// Band parameters used by the charge-neutrality solver
+struct SemiconductorModel {
+    string name;
+    double Eg0_eV;        // band gap at 0 K
+    double varshni_alpha; // eV/K, Eg(T) = Eg0 - αT²/(T + β)
+    double varshni_beta;  // K
+    double me_dos, mh_dos; // density-of-states effective masses (units of m0)
+};
+
+// Dopant densities (cm⁻³) and ionisation energies measured from the nearer band edge (eV)
+struct DopantParams {
+    double Nd, Ed_eV;
+    double Na, Ea_eV;
+};
+
+// Magnetoconductivity tensor of one sample at one temperature
+struct MagnetoTransportSet {
+    string sample_id;
+    double T_K;
+    vector<double> B;        // T
+    vector<double> sigma_xx; // S/cm
+    vector<double> sigma_xy; // S/cm
+};
+
+// One carrier species found as a peak of the mobility spectrum
+struct CarrierSpecies {
+    bool holes;
+    double mobility;     // cm²/(V·s), magnitude
+    double conductivity; // S/cm
+    double density;      // cm⁻³
+};
+
+struct MobilitySpectrum {
+    string sample_id;
+    double T_K;
+    vector<double> mobility;     // signed grid, cm²/(V·s); negative for electrons
+    vector<double> conductivity; // S/cm carried at each grid mobility
+    vector<CarrierSpecies> carriers;
+    double residual;             // relative fit residual
+};
+
+// Mobility grid for the spectrum: log-spaced magnitudes for each carrier sign
+const int spectrum_points_per_sign = 40;
+const double spectrum_min_mobility = 10.0;  // cm²/(V·s)
+const double spectrum_max_mobility = 1e6;
+
+// Scratch space for the non-negative least-squares solver, sized once per worker
+// thread so a batch of spectra allocates nothing per fit
+struct NnlsWorkspace {
+    vector<double> gram, cholesky, Atb, x, z, w;
+    vector<double> row_xx, row_xy;  // design matrix rows at one field
+    vector<int> passive;
+    vector<size_t> passive_index;
+    
+    explicit NnlsWorkspace(size_t columns = 0) { reserve(columns); }
+    void reserve(size_t columns) {
+        gram.resize(columns * columns);
+        cholesky.resize(columns * columns);
+        Atb.resize(columns);
+        x.resize(columns);
+        z.resize(columns);
+        w.resize(columns);
+        row_xx.resize(columns);
+        row_xy.resize(columns);
+        passive.resize(columns);
+        passive_index.resize(columns);
+    }
+};
+
+// Electron + hole (two-band) fit of one magnetotransport set
+struct TwoCarrierFit {
+    string sample_id;
+    double T_K;
+    double electron_density, electron_mobility; // cm⁻³, cm²/(V·s)
+    double hole_density, hole_mobility;
+    double residual;  // relative RMS of the scaled residuals
+    int iterations;
+    bool converged;
+};
+
+// Carrier-based material classes from the README
+enum MaterialClass { CLASS_METAL, CLASS_N_TYPE, CLASS_P_TYPE, CLASS_INSULATOR, CLASS_HEAVILY_DOPED, NUM_MATERIAL_CLASSES };
+const char *const material_class_names[NUM_MATERIAL_CLASSES] = {
+    "Metal", "n-type semiconductor", "p-type semiconductor", "Insulator", "Heavily doped semiconductor / poor metal"
+};
+
+// Feature vector the carrier classifier sees, one row per sample
+enum CarrierFeature {
+    FEATURE_LOG_CONDUCTIVITY,    // log10 σ (S/cm)
+    FEATURE_LOG_MAJORITY_DENSITY, // log10 majority carrier density (cm⁻³)
+    FEATURE_MAJORITY_SIGN,       // -1 electrons, +1 holes
+    FEATURE_LOG_MAJORITY_MOBILITY, // log10 majority mobility (cm²/(V·s))
+    NUM_CARRIER_FEATURES
+};
+
+// Decision tree as read from a file; x[feature] < threshold goes left
+struct TreeNode {
+    bool leaf;
+    int feature;
+    double threshold;
+    int left, right;
+    int label;
+};
+
+struct DecisionTree {
+    vector<TreeNode> nodes; // root is node 0
+};
+
+// Forest flattened into complete binary trees of equal depth. Node i of a tree has
+// children 2i+1 and 2i+2, so walking a tree is depth steps of index arithmetic with no
+// branches; shallow leaves are padded with always-left nodes down to full depth.
+struct CompiledForest {
+    int depth;
+    size_t num_trees;
+    vector<int> feature;             // num_trees × (2^depth - 1)
+    vector<double> threshold;        // num_trees × (2^depth - 1)
+    vector<unsigned char> leaf_class; // num_trees × 2^depth
+};
+
+const int max_tree_depth = 16;
+const int max_tree_nodes = (2 << max_tree_depth) - 1;  // a full tree of max_tree_depth
+const size_t max_forest_trees = 65535;                 // classifyBatch counts votes in unsigned short
+
+// Dielectric feature vector used to identify an unknown sample. Features that were not
+// measured (the loss peak needs a loss-tangent sweep) are NaN and left out of distances.
+enum DielectricFeature {
+    FEATURE_PEAK_EPSILON,   // maximum ε
+    FEATURE_CURIE_TEMP,     // °C
+    FEATURE_CURIE_CONSTANT, // K, from the Curie-Weiss fit
+    FEATURE_LOSS_PEAK,      // maximum tan δ
+    NUM_DIELECTRIC_FEATURES
+};
+
+struct DielectricFeatures {
+    double values[NUM_DIELECTRIC_FEATURES];
+};
+
+// Reference materials in structure-of-arrays form: one contiguous column per feature,
+// stored already divided by the column's spread so distances need no per-pair scaling
+struct DielectricLibrary {
+    vector<string> names;
+    vector<double> columns[NUM_DIELECTRIC_FEATURES];
+    double scale[NUM_DIELECTRIC_FEATURES]; // standard deviation of each raw column
+};
+
+struct Neighbour {
+    size_t index;
+    double distance;
+};
+
+// Everything measured on one physical sample, linked by sample id. The fused feature
+// vector is the dielectric features followed by the carrier features; whichever
+// measurement is missing contributes NaNs.
+const int NUM_FUSED_FEATURES = NUM_DIELECTRIC_FEATURES + NUM_CARRIER_FEATURES;
+const int no_hall_bucket = NUM_MATERIAL_CLASSES; // index bucket for records without Hall data
+const double fused_rescan_distance = 3.0;        // scan every bucket if the best match is worse
+
+struct SampleRecord {
+    string sample_id;
+    string material;  // known material for reference records, empty otherwise
+    bool has_dielectric;
+    bool has_hall;
+    double features[NUM_FUSED_FEATURES];
+};
+
+// Reference records for fused identification, indexed by the carrier class the
+// classifier assigns from their Hall data. Rows are grouped by bucket, and each
+// feature is one scaled column as in DielectricLibrary.
+struct FusedReferenceIndex {
+    vector<string> names;
+    vector<double> columns[NUM_FUSED_FEATURES];
+    double scale[NUM_FUSED_FEATURES];
+    size_t bucket_start[NUM_MATERIAL_CLASSES + 2]; // bucket b is rows [start[b], start[b + 1])
+};
+
+struct FusedMatch {
+    string best, runner_up;
+    double best_distance, runner_up_distance;
+    int hall_class; // no_hall_bucket when the sample had no Hall data
+};
+
+// Labelled carrier feature vectors for judging a classifier, row-major like classifyBatch
+struct LabelledCarrierSet {
+    vector<double> features;      // NUM_CARRIER_FEATURES per sample
+    vector<unsigned char> labels; // true MaterialClass
+};
+
+// Summary of one analysed sweep, computed without printing
+struct RunResult {
+    string name;
+    size_t num_readings;
+    double C0;
+    double peak_epsilon;
+    int peak_temp;
+    CuriePrediction prediction;
+};
+
+// Report formats written by saveToFile() and plate runs
+enum ReportFormat { REPORT_TEXT, REPORT_JSON_LINES, REPORT_BOTH };
+ReportFormat report_format = REPORT_TEXT;
+
+// JSON Lines output for log pipelines. Records are formatted straight into a
+// preallocated buffer that goes to the file in large writes whenever it fills.
+struct JsonLinesWriter {
+    ofstream *out;
+    vector<char> buffer;
+    size_t used;
+    bool first_field;   // no comma before the next field
+};
+
+// Run store: every analysed sweep is appended to run_store_file as one fixed-size
+// binary record, so the history can be reloaded without parsing text reports
+const char *const run_store_file = "run_store.bin";
+
+struct RunRecord {
+    int64_t timestamp;        // seconds since the epoch
+    char material[32];        // NUL-terminated
+    double curie_estimate_C;  // NaN when no Curie temperature was found
+    double expected_curie_C;  // from the materials database, -1 for non-ferroelectrics
+    double peak_epsilon;
+    double curie_weiss_T0_C;  // NaN when the peak was not passed
+    double curie_constant;    // K, NaN when the peak was not passed
+    int32_t num_readings;
+    int32_t reserved;
+};
+const size_t max_material_name = sizeof(RunRecord::material) - 1; // bytes; longer names are refused, not cut
+const size_t max_run_materials = 65536;                            // distinct names a uint16_t material id can hold
+
+// Run store loaded column by column. Values are floats and materials are dictionary
+// ids to keep millions of runs compact in memory.
+struct RunColumns {
+    vector<string> materials;       // dictionary, indexed by material_id
+    vector<uint16_t> material_id;
+    vector<int64_t> timestamp;
+    vector<float> curie_estimate;
+    vector<float> expected_curie;
+    vector<float> peak_epsilon;
+    vector<float> curie_weiss_T0;
+    vector<float> curie_constant;
+    vector<int32_t> num_readings;
+    
+    size_t size() const { return timestamp.size(); }
+};
+
+// Statistical process control of the Curie estimate, one chart per material. The first
+// spc_baseline_runs runs estimate the process centre and spread (Welford); after that each
+// run updates an EWMA and a two-sided tabular CUSUM around that centre in O(1). Charting
+// against the measured centre rather than the database value keeps a fixed estimator
+// offset from alarming. An alarm stays raised until the EWMA and both CUSUM sides are
+// back well inside their limits, so a sustained shift is not counted again each time
+// the chart touches a limit. State persists in spc_state_file between sessions.
+const char *const spc_state_file = "spc_state.txt";
+const int spc_baseline_runs = 20;
+const double spc_lambda = 0.2;      // EWMA weight of the newest run
+const double spc_ewma_limit = 3.0;  // EWMA control limit, in EWMA standard deviations
+const double spc_cusum_k = 0.5;     // CUSUM allowance, in process sigmas
+const double spc_cusum_h = 5.0;     // CUSUM decision interval, in process sigmas
+const double spc_min_sigma = 0.05;  // °C, floor for a suspiciously quiet baseline
+const double spc_clear_fraction = 0.5; // an alarm clears once the chart is this far inside its limits
+
+struct SpcState {
+    string material;
+    double target;          // expected Curie temperature
+    size_t runs;
+    double baseline_mean, baseline_m2; // Welford accumulators; the mean is the chart centre
+    double sigma;           // process standard deviation, fixed after the baseline
+    double ewma;
+    double cusum_high, cusum_low;
+    bool alarm;             // latest run was out of control
+    size_t alarms;          // times the chart went out of control
+    int64_t last_alarm;     // timestamp of the run that raised the latest alarm
+};
+
+// Daily rollups of the run store per material, kept up to date as runs are saved so
+// historical summaries are read from buckets instead of rescanning every run. Days are UTC.
+const char *const rollup_file = "run_rollups.txt";
+
+struct RunRollup {
+    int64_t day;            // days since the epoch
+    string material;
+    size_t runs;
+    size_t curie_runs;      // runs with a Curie estimate
+    double curie_sum, curie_min, curie_max;
+    double peak_epsilon_sum, peak_epsilon_max;
+};
+
+typedef map<pair<int64_t, string>, RunRollup> RollupTable;
+
+// Arrow IPC columns, for handing readings and results to Arrow-based analysis tools.
+// Values are never null (missing Curie temperatures are NaN) and timestamps are
+// seconds since the epoch, UTC.
+enum ArrowType { ARROW_INT32, ARROW_FLOAT32, ARROW_FLOAT64, ARROW_TIMESTAMP, ARROW_UTF8 };
+
+struct ArrowColumn {
+    string name;
+    ArrowType type;
+    const void *values;      // fixed-width values, or the bytes of all strings
+    const int32_t *offsets;  // ARROW_UTF8 only: rows + 1 offsets into values
+};
+
+// An Arrow IPC file or stream opened for reading. The file is memory-mapped where mmap
+// is available, and read into storage otherwise (a pipe, or no mmap). The columns of
+// each record batch point into it in place, so an ArrowFile cannot be copied.
+struct ArrowFile {
+    const uint8_t *bytes;
+    size_t size;
+    void *mapping;                       // null unless the file is mapped
+    vector<uint64_t> storage;            // 8-byte aligned copy when it is not
+    vector<ArrowColumn> schema;          // names and types only
+    vector<size_t> batch_rows;
+    vector<vector<ArrowColumn>> batches;
+    
+    ArrowFile() : bytes(0), size(0), mapping(0) {}
+    ArrowFile(const ArrowFile &) = delete;
+    ArrowFile &operator=(const ArrowFile &) = delete;
+    ~ArrowFile() { release(); }
+    
+    void release() {
+#ifdef MMAP_SUPPORTED
+        if (mapping) munmap(mapping, size);
+#endif
+        mapping = 0;
+        bytes = 0;
+        size = 0;
+        storage.clear();
+        schema.clear();
+        batch_rows.clear();
+        batches.clear();
+    }
+};
+
+// Interactive saves also write the readings as Arrow IPC; switched on in arrowTools()
+bool save_arrow_readings = false;
+
+// Per-run features clustered by clusterRuns()
+const int NUM_RUN_FEATURES = 4;
+
+struct KMeansResult {
+    int k;
+    int iterations;
+    double inertia;              // sum of squared distances to the assigned centroid
+    vector<double> centroids;    // k × NUM_RUN_FEATURES, in standardised units
+    vector<uint8_t> assignment;  // cluster of every point
+    vector<size_t> counts;
+};
+
+// Query engine over the run store. A query is a conjunction of predicates on columns,
+// evaluated block by block into a selection mask, then aggregated per material.
+enum RunColumn {
+    COL_CURIE, COL_EXPECTED, COL_DEVIATION, COL_PEAK_EPSILON, COL_CURIE_WEISS_T0, COL_CURIE_CONSTANT,
+    COL_READINGS, COL_DATE, COL_MATERIAL, NUM_RUN_COLUMNS
+};
+const char *const run_column_names[NUM_RUN_COLUMNS] = {
+    "curie", "expected", "deviation", "peak_eps", "t0", "curie_const", "readings", "date", "material"
+};
+
+enum PredicateOp { OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE, OP_BETWEEN, OP_OUTSIDE };
+
+struct RunPredicate {
+    RunColumn column;
+    PredicateOp op;
+    double low, high;   // high only for between/outside; timestamps for date, dictionary id for material
+};
+
+struct RunQuery {
+    vector<RunPredicate> filters;
+    bool group_by_material;
+    RunColumn aggregate;    // numeric column summarised for the matching runs
+};
+
+struct QueryGroup {
+    size_t count;           // matching runs
+    size_t valued;          // matching runs with a value in the aggregate column
+    double sum, sum_sq, min, max;
+};
+
+struct QueryResult {
+    vector<QueryGroup> groups;  // indexed by material id, or a single group
+    vector<size_t> first_rows;  // first matching rows in store order
+};
+
+// Timeline tracing of pipeline stages, exported in the Chrome trace format for
+// chrome://tracing or Perfetto. Each thread records into its own buffer, so recording
+// takes no lock; buffers of finished threads are handed to the next new thread, which
+// keeps one timeline lane per worker slot. When tracing is off a TraceScope costs one
+// relaxed atomic load.
+struct TraceEvent {
+    const char *name;   // string literal
+    int64_t start_us, duration_us;
+};
+
+struct TraceBuffer {
+    int lane;
+    bool in_use;
+    vector<TraceEvent> events;
+};
+
+atomic<bool> tracing_enabled(false);
+
+void recordTraceEvent(const char *name, chrono::steady_clock::time_point start);
+
+// Records the enclosing block as one stage on the calling thread's timeline
+struct TraceScope {
+    const char *name;
+    bool active;
+    chrono::steady_clock::time_point start;
+    
+    explicit TraceScope(const char *stage) : name(stage), active(tracing_enabled.load(memory_order_relaxed)) {
+        if (active) start = chrono::steady_clock::now();
+    }
+    ~TraceScope() {
+        if (active) recordTraceEvent(name, start);
+    }
+};
+
+// Latency histograms per pipeline stage, HDR style: values in nanoseconds fall into
+// 64 linear sub-buckets per power of two (under 1.6% error), from 1 ns to about 36 minutes.
+// Recording is a relaxed atomic increment, so any thread may record without a lock. The
+// histograms are process-wide, so the library build records nothing.
+enum LatencyStage {
+    LATENCY_READING_TO_ESTIMATE,  // live sweep: reading entered to updated Curie estimate
+    LATENCY_SAMPLE_ANALYSIS,      // one sample in a batch
+    LATENCY_PLATE_RUN,            // plate run request to printed results
+    NUM_LATENCY_STAGES
+};
+const char *const latency_stage_names[NUM_LATENCY_STAGES] = {
+    "Reading -> Curie estimate", "Sample analysis", "Plate run"
+};
+
+const int latency_sub_buckets = 64;
+const int latency_max_exponent = 40;
+const int latency_buckets = latency_sub_buckets * (latency_max_exponent - 4);
+
+struct LatencyHistogram {
+    atomic<uint64_t> counts[latency_buckets];
+    atomic<uint64_t> total, sum_ns, max_ns;
+};
+
+void recordLatency(LatencyStage stage, chrono::steady_clock::duration elapsed);
+
+// Records the time until the end of the enclosing block under a stage
+#ifdef MATERIAL_IDENTIFIER_LIBRARY
+struct LatencyTimer {
+    explicit LatencyTimer(LatencyStage) {}
+};
+#else
+struct LatencyTimer {
+    LatencyStage stage;
+    chrono::steady_clock::time_point start;
+    
+    explicit LatencyTimer(LatencyStage timed_stage) : stage(timed_stage), start(chrono::steady_clock::now()) {}
+    ~LatencyTimer() { recordLatency(stage, chrono::steady_clock::now() - start); }
+};
+#endif
+
+// Process metrics exported in the Prometheus text format. Counters live in per-thread
+// shards that only their own thread writes, so counting never contends; a scrape sums
+// the shards. The library build counts nothing: it keeps no process-wide state and
+// does not allocate on the caller's threads.
+enum MetricCounter {
+    METRIC_READINGS_INGESTED,
+    METRIC_RUNS_ANALYZED,
+    METRIC_RUNS_STORED,
+    NUM_METRIC_COUNTERS
+};
+
+// Work queues of running parallel loops, so a scrape can report their depth
+#ifdef MATERIAL_IDENTIFIER_LIBRARY
+inline void countMetric(MetricCounter, uint64_t) {}
+inline void registerWorkQueue(const atomic<size_t> *, size_t) {}
+inline void unregisterWorkQueue(const atomic<size_t> *) {}
+#else
+void countMetric(MetricCounter counter, uint64_t amount);
+void registerWorkQueue(const atomic<size_t> *next, size_t n);
+void unregisterWorkQueue(const atomic<size_t> *next);
+#endif
+
+// Hardware counters read around benchmarked kernels (Linux perf_event_open). Events
+// that the kernel, a virtual machine or perf_event_paranoid refuse are reported missing.
+enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    NUM_PERF_EVENTS
+};
+
+struct PerfCounterGroup {
+    int fds[NUM_PERF_EVENTS];     // -1 where the event could not be opened
+    int order[NUM_PERF_EVENTS];   // event of each value in a group read
+    int num_open;
+    string status;                // why counters are missing, if any are
+};
+
+// One kernel at one input size. Counters cover every repetition.
+struct BenchmarkPoint {
+    const char *kernel;
+    size_t size;
+    size_t items;                 // items processed over all repetitions
+    double seconds;
+    uint64_t counters[NUM_PERF_EVENTS];
+    bool counted[NUM_PERF_EVENTS];
+};
+
+// Per-item time of one benchmark point over repeated suite runs
+struct BenchmarkStats {
+    string kernel;
+    size_t size;
+    int repetitions;
+    double mean_ns, stddev_ns;
+};
+
+const char *const benchmark_baseline_file = "benchmark_baseline.txt";
+
+// Heap accounting by pipeline stage. Every allocation is charged to the stage tagged on
+// the allocating thread and refunded to that stage when freed, so live bytes show which
+// stage holds memory. Counted in the program build only: the library must not replace
+// the host application's operator new.
+enum MemoryStage {
+    MEMORY_OTHER,
+    MEMORY_INGEST,        // parsing input files and the raw reading stream
+    MEMORY_READINGS,      // per-sample reading vectors
+    MEMORY_INTERMEDIATE,  // analysis scratch and result columns
+    MEMORY_OUTPUT,        // reports, run records and write buffers
+    NUM_MEMORY_STAGES
+};
+const char *const memory_stage_names[NUM_MEMORY_STAGES] = {
+    "Other", "Ingest", "Readings", "Intermediate", "Output"
+};
+
+extern thread_local MemoryStage current_memory_stage;
+
+// Tags allocations in the enclosing block with a stage
+struct MemoryStageScope {
+    MemoryStage previous;
+    
+    explicit MemoryStageScope(MemoryStage stage) : previous(current_memory_stage) { current_memory_stage = stage; }
+    ~MemoryStageScope() { current_memory_stage = previous; }
+};
+
+// Number of worker threads parallelFor uses for n items
+inline unsigned workerCount(size_t n) {
+    unsigned num_threads = max(1u, thread::hardware_concurrency());
+    return static_cast<unsigned>(min<size_t>(num_threads, n));
+}
+
+// Runs fn(worker, i) for i in [0, n) on workerCount(n) threads, where worker is the
+// index of the calling thread (for per-thread scratch space). Items are handed out one
+// at a time, so uneven work (long and short sweeps) stays balanced.
+template <class Fn>
+void parallelForWorkers(size_t n, Fn fn) {
+    atomic<size_t> next(0);
+    registerWorkQueue(&next, n);
+    MemoryStage stage = current_memory_stage;  // workers allocate for the caller's stage
+    vector<thread> workers;
+    for (unsigned t = 0; t < workerCount(n); t++) {
+        workers.push_back(thread([&, t]() {
+            MemoryStageScope memory(stage);
+            for (size_t i = next++; i < n; i = next++) fn(t, i);
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+    unregisterWorkQueue(&next);
+}
+
+// Runs fn(i) for i in [0, n) on the worker pool
+template <class Fn>
+void parallelFor(size_t n, Fn fn) {
+    parallelForWorkers(n, [&](unsigned, size_t i) { fn(i); });
+}
+
 // Function declarations
 void showTheory();
 void showApparatus();
@@ -36,18 +739,172 @@ void inputReadings(Sample &sample);
 void calculateDielectricConstants(Sample &sample);
 void displayGraph(Sample &sample);
 void analyzeCurieTemperature(Sample &sample);
-void saveToFile(Sample &sample);
+void saveToFile(Sample &sample, const RunResult &result);
 void simulate();
 void clearInputBuffer();
+double vacuumCapacitance(const Sample &sample);
+CuriePrediction predictCurieTemperature(const Sample &sample);
+void advancedTools();
+void evaluateEarlyCuriePrediction();
+RunResult computeRunResult(const Sample &sample);
+vector<RunResult> analyzeSamplesConcurrently(const vector<Sample> &samples);
+bool parseMultiplexedRun(istream &file, MultiplexedRun &run);
+bool loadMultiplexedRun(const string &filename, MultiplexedRun &run);
+map<int, Sample> demultiplexRun(const MultiplexedRun &run);
+void analyzeMultiplexedRun();
+void solveSheetResistanceBatch(const double *RA, const double *RB, double *Rs, unsigned char *converged, size_t n);
+vector<HallResult> analyzeVanDerPauwBatch(const vector<VanDerPauwMeasurement> &measurements);
+bool loadVanDerPauwMeasurements(const string &filename, vector<VanDerPauwMeasurement> &measurements);
+void analyzeVanDerPauwFile();
+HallSweepResult analyzeHallSweep(const HallSweep &sweep);
+vector<HallSweepResult> analyzeHallSweepsConcurrently(const vector<HallSweep> &sweeps);
+bool loadHallSweeps(const string &filename, vector<HallSweep> &sweeps);
+void analyzeHallSweepFile();
+double logFermiDiracHalf(double eta);
+void solveChargeNeutrality(const SemiconductorModel &model, const DopantParams &dopants, const double *T,
+                           double *Ef_minus_Ec, double *n, double *p, size_t count);
+DopantParams fitDopantsToHallSweep(const SemiconductorModel &model, const HallSweep &sweep, double &rms_log_error);
+void fitChargeNeutralityFile();
+void solveNnls(size_t columns, NnlsWorkspace &ws);
+MobilitySpectrum computeMobilitySpectrum(const MagnetoTransportSet &set, NnlsWorkspace &ws);
+vector<MobilitySpectrum> computeMobilitySpectraConcurrently(const vector<MagnetoTransportSet> &sets);
+bool loadMagnetoTransportSets(const string &filename, vector<MagnetoTransportSet> &sets);
+void analyzeMobilitySpectrumFile();
+void carrierFeatures(double electron_density, double electron_mobility, double hole_density, double hole_mobility, double *x);
+string classifyCarriers(double electron_density, double electron_mobility, double hole_density, double hole_mobility);
+TwoCarrierFit fitTwoCarrierModel(const MagnetoTransportSet &set);
+vector<TwoCarrierFit> fitTwoCarrierModelsConcurrently(const vector<MagnetoTransportSet> &sets);
+void fitTwoCarrierFile();
+bool parseForest(istream &in, vector<DecisionTree> &forest, string &error);
+CompiledForest compileForest(const vector<DecisionTree> &forest);
+void classifyBatch(const CompiledForest &forest, const double *features, size_t n, unsigned char *classes);
+int classifyWithTree(const vector<DecisionTree> &forest, const double *x);
+CompiledForest &activeMaterialForest();
+void loadMaterialClassifier();
+void benchmarkMaterialClassifier();
+DielectricFeatures extractDielectricFeatures(const RunResult &result);
+bool loadDielectricFeatureFile(const string &filename, vector<string> &names, vector<DielectricFeatures> &features);
+DielectricLibrary buildDielectricLibrary(const vector<string> &names, const vector<DielectricFeatures> &features);
+void accumulateColumnDistances(const double *query, const double *scale, const vector<double> *columns, int num_features,
+                               size_t begin, size_t end, double *sum, double *used);
+vector<vector<Neighbour>> knnSearchBatch(const DielectricLibrary &library, const vector<DielectricFeatures> &queries, size_t k);
+void identifyDielectricsKnn();
+bool loadSampleRecords(const string &filename, vector<SampleRecord> &records);
+FusedReferenceIndex buildFusedReferenceIndex(const vector<SampleRecord> &references);
+vector<FusedMatch> identifyFusedBatch(const FusedReferenceIndex &index, const vector<SampleRecord> &samples);
+void identifyFusedRecords();
+LabelledCarrierSet generateLabelledCarrierSet(size_t n, unsigned seed);
+bool loadLabelledCarrierSet(const string &filename, LabelledCarrierSet &set);
+vector<SampleRecord> generateLabelledFusedRecords(size_t num_materials, size_t per_material, unsigned seed);
+void evaluateFusedIdentifier(const vector<SampleRecord> &references, const vector<SampleRecord> &samples);
+void evaluateMaterialClassifier();
+bool makeRunRecord(const Sample &sample, const RunResult &result, RunRecord &record);
+bool appendRunRecords(const vector<RunRecord> &records);
+bool loadRunColumns(const string &filename, RunColumns &runs);
+KMeansResult kMeansCluster(const vector<const float *> &columns, size_t n, int k, bool mini_batch, unsigned seed);
+void clusterRuns();
+SpcState newSpcState(const string &material, double target);
+bool updateSpc(SpcState &state, double curie_estimate, int64_t timestamp);
+bool loadSpcStates(map<string, SpcState> &states);
+bool saveSpcStates(const map<string, SpcState> &states);
+void updateSpcForRuns(const vector<RunRecord> &records);
+map<string, SpcState> backfillSpc(const RunColumns &runs);
+void showSpcCharts();
+void addToRollup(RunRollup &rollup, double curie_estimate, double peak_epsilon);
+bool loadRollups(RollupTable &rollups);
+bool saveRollups(const RollupTable &rollups);
+void updateRollupsForRuns(const vector<RunRecord> &records);
+RollupTable rebuildRollups(const RunColumns &runs);
+void showRollups();
+void storeRuns(const vector<RunRecord> &records);
+bool writeArrowIpc(const string &filename, const vector<ArrowColumn> &columns, size_t num_rows, size_t batch_rows, bool file_format);
+bool readArrowIpc(const string &filename, ArrowFile &file, string &error);
+void arrowTools();
+bool parseRunPredicate(const string &text, const RunColumns &runs, RunPredicate &predicate, string &error);
+QueryResult runQuery(const RunColumns &runs, const RunQuery &query, size_t max_rows);
+void queryRuns();
+void jsonOpen(JsonLinesWriter &writer, ofstream &out);
+void jsonBeginRecord(JsonLinesWriter &writer);
+void jsonNumber(JsonLinesWriter &writer, const char *key, double value);
+void jsonInteger(JsonLinesWriter &writer, const char *key, int64_t value);
+void jsonString(JsonLinesWriter &writer, const char *key, const string &value);
+void jsonEndRecord(JsonLinesWriter &writer);
+bool jsonFlush(JsonLinesWriter &writer);
+void writeJsonLinesReport(JsonLinesWriter &writer, const Sample &sample, const RunResult &result, int channel);
+void chooseReportFormat();
+void startTracing();
+bool writeChromeTrace(const string &filename);
+void traceTools();
+size_t latencyBucket(uint64_t ns);
+uint64_t latencyBucketValue(size_t bucket);
+void printLatencyPercentiles(ostream &out);
+void latencyTools();
+string formatPrometheusMetrics();
+void metricsTools();
+void openPerfCounters(PerfCounterGroup &group);
+void closePerfCounters(PerfCounterGroup &group);
+void startPerfCounters(PerfCounterGroup &group);
+void stopPerfCounters(PerfCounterGroup &group, BenchmarkPoint &point);
+vector<BenchmarkPoint> runBenchmarkSuite(PerfCounterGroup &counters);
+void printBenchmarkPoints(const vector<BenchmarkPoint> &points, const PerfCounterGroup &counters);
+void benchmarkSuite();
+vector<BenchmarkStats> measureBenchmarkStats(int repetitions);
+bool saveBenchmarkBaseline(const vector<BenchmarkStats> &stats);
+bool loadBenchmarkBaseline(vector<BenchmarkStats> &stats);
+int compareBenchmarks(const vector<BenchmarkStats> &current, const vector<BenchmarkStats> &baseline, double threshold);
+int runRegressionGate(int repetitions, double threshold, bool save_baseline);
+void regressionGate();
+void beginMemoryRun();
+void printMemoryReport();
+const map<string, Sample> &builtinMaterials();
+vector<string> materialNames();
+bool findMaterial(const string &name, Sample &sample);
+bool findCurieTemperature(const char *name, double &curie_temp_C);
+bool loadMaterialsText(const string &filename, map<string, Sample> &database);
+bool writeMaterialsSnapshot(const string &filename, const map<string, Sample> &database);
+void materialsSnapshotTools();
 
-// Materials database
-map<string, Sample> materials = {
-    {"Barium Titanate", {"Barium Titanate", 8 * 6, 1.42, 120, {}}},
-    {"Titanium Dioxide", {"Titanium Dioxide", 8 * 6, 1.42, 50, {}}},
-    {"Quartz", {"Quartz", 8 * 6, 1.42, -1, {}}}
+// Semiconductor database for carrier statistics
+map<string, SemiconductorModel> semiconductors = {
+    {"Silicon", {"Silicon", 1.170, 4.73e-4, 636, 1.09, 1.15}},
+    {"Germanium", {"Germanium", 0.7437, 4.77e-4, 235, 0.56, 0.29}},
+    {"Gallium Arsenide", {"Gallium Arsenide", 1.519, 5.405e-4, 204, 0.067, 0.48}}
 };
 
-int main() {
+// Materials database
+// Built-in materials database, built on first use. A materials snapshot (see
+// findMaterial) takes its place when one is present.
+const map<string, Sample> &builtinMaterials() {
+    static const map<string, Sample> materials = {
+        {"Barium Titanate", {"Barium Titanate", 8 * 6, 1.42, 120, {}}},
+        {"Titanium Dioxide", {"Titanium Dioxide", 8 * 6, 1.42, 50, {}}},
+        {"Quartz", {"Quartz", 8 * 6, 1.42, -1, {}}}
+    };
+    return materials;
+}
+
+#ifndef MATERIAL_IDENTIFIER_LIBRARY
+int main(int argc, char *argv[]) {
+    // Command-line mode for build scripts: exits non-zero when a kernel has regressed
+    if (argc > 1) {
+        string mode = argv[1];
+        int repetitions = 5;
+        double threshold_percent = 10.0;
+        bool ok = mode == "--benchmark-gate" || mode == "--save-benchmark-baseline";
+        for (int i = 2; i + 1 < argc && ok; i += 2) {
+            string option = argv[i];
+            if (option == "--repetitions") repetitions = atoi(argv[i + 1]);
+            else if (option == "--threshold") threshold_percent = atof(argv[i + 1]);
+            else ok = false;
+        }
+        if (!ok || argc % 2 != 0 || repetitions < 2 || threshold_percent <= 0) {
+            cout << "Usage: " << argv[0] << " --benchmark-gate [--repetitions N] [--threshold PERCENT]\n"
+                 << "       " << argv[0] << " --save-benchmark-baseline [--repetitions N]\n";
+            return 2;
+        }
+        return runRegressionGate(repetitions, threshold_percent / 100.0, mode == "--save-benchmark-baseline");
+    }
+    
     int choice;
     do {
         cout << "\n===== Dielectric Constant and Curie Temperature Simulation =====\n";
@@ -57,6 +914,7 @@ int main() {
         cout << "4. Show Precautions\n";
         cout << "5. Start Simulation\n";
         cout << "6. Exit\n";
+        cout << "7. Advanced Analysis Tools\n";
         cout << "Enter your choice: ";
         
         // Improved input handling
@@ -73,12 +931,14 @@ int main() {
             case 4: showPrecautions(); break;
             case 5: simulate(); break;
             case 6: cout << "Exiting program.\n"; break;
+            case 7: advancedTools(); break;
             default: cout << "Invalid choice. Try again.\n";
         }
     } while (choice != 6);
 
     return 0;
 }
+#endif
 
 void clearInputBuffer() {
     cin.clear();
@@ -120,11 +980,9 @@ void showPrecautions() {
 
 void simulate() {
     cout << "\nAvailable materials:\n";
-    int index = 1;
-    vector<string> keys;
-    for (map<string, Sample>::iterator it = materials.begin(); it != materials.end(); ++it) {
-        cout << index++ << ". " << it->first << endl;
-        keys.push_back(it->first);
+    vector<string> keys = materialNames();
+    for (size_t i = 0; i < keys.size(); i++) {
+        cout << i + 1 << ". " << keys[i] << endl;
     }
     
     int material_choice;
@@ -137,26 +995,51 @@ void simulate() {
     }
     
     // Safe access to the selected material
-    Sample sample = materials[keys[material_choice - 1]];
+    Sample sample;
+    findMaterial(keys[material_choice - 1], sample);
     
     // Clear any existing data (if reusing the sample)
     sample.temp_capacitance_data.clear();
 
-    inputReadings(sample);
+    beginMemoryRun();
+    {
+        TraceScope trace("ingest");
+        MemoryStageScope memory(MEMORY_READINGS);
+        inputReadings(sample);
+    }
     
     // Only proceed if we have data
     if (!sample.temp_capacitance_data.empty()) {
-        calculateDielectricConstants(sample);
+        {
+            TraceScope trace("epsilon");
+            MemoryStageScope memory(MEMORY_INTERMEDIATE);
+            calculateDielectricConstants(sample);
+        }
         
         // Only analyze Curie temperature for ferroelectric materials
         if (sample.curie_temp_C > 0) {
+            TraceScope trace("curie analysis");
+            MemoryStageScope memory(MEMORY_INTERMEDIATE);
             analyzeCurieTemperature(sample);
         } else {
             cout << "\nNote: This material doesn't have a Curie temperature (non-ferroelectric).\n";
         }
         
-        displayGraph(sample);
-        saveToFile(sample);
+        {
+            TraceScope trace("graph");
+            MemoryStageScope memory(MEMORY_INTERMEDIATE);
+            displayGraph(sample);
+        }
+        {
+            TraceScope trace("save");
+            MemoryStageScope memory(MEMORY_OUTPUT);
+            RunResult result = computeRunResult(sample);
+            countMetric(METRIC_RUNS_ANALYZED, 1);
+            saveToFile(sample, result);
+            RunRecord record;
+            if (makeRunRecord(sample, result, record)) storeRuns(vector<RunRecord>(1, record));
+        }
+        printMemoryReport();
     } else {
         cout << "\nNo data entered. Returning to main menu.\n";
     }
@@ -166,6 +1049,7 @@ void inputReadings(Sample &sample) {
     cout << "\nEnter temperature (°C) and capacitance (pF). Type -1 for temperature to stop.\n";
     int temp;
     double capacitance;
+    bool stop_announced = false;
     
     while (true) {
         cout << "Temperature (°C): ";
@@ -191,6 +1075,21 @@ void inputReadings(Sample &sample) {
         }
         
         sample.temp_capacitance_data.push_back(make_pair(temp, capacitance));
+        countMetric(METRIC_READINGS_INGESTED, 1);
+        
+        // Tell the operator as soon as the Curie temperature is settled
+        if (sample.curie_temp_C > 0 && !stop_announced) {
+            LatencyTimer timer(LATENCY_READING_TO_ESTIMATE);
+            Sample sorted_sample = sample;
+            sort(sorted_sample.temp_capacitance_data.begin(), sorted_sample.temp_capacitance_data.end());
+            CuriePrediction prediction = predictCurieTemperature(sorted_sample);
+            if (prediction.can_stop) {
+                cout << fixed << setprecision(1);
+                cout << ">> Curie temperature predicted at " << prediction.predicted_curie_C
+                     << " ± " << prediction.uncertainty_C << "°C. The sweep can be stopped (enter -1).\n";
+                stop_announced = true;
+            }
+        }
     }
     
     // Sort data by temperature (ascending) for better display
@@ -241,6 +1140,15 @@ void analyzeCurieTemperature(Sample &sample) {
     cout << "\nEstimated Curie Temperature: " << max_temp << "°C\n";
     cout << "Expected Curie Temperature for " << sample.name << ": " << sample.curie_temp_C << "°C\n";
     cout << "Difference: " << abs(max_temp - sample.curie_temp_C) << "°C\n";
+    
+    // Curie-Weiss extrapolation from the readings above the peak
+    CuriePrediction prediction = predictCurieTemperature(sample);
+    if (prediction.peak_passed) {
+        cout << "Refined Curie Temperature: " << prediction.predicted_curie_C
+             << " ± " << prediction.uncertainty_C << "°C\n";
+        cout << "Curie-Weiss fit above peak: T0 = " << prediction.curie_weiss_T0_C
+             << "°C, C = " << prediction.curie_constant << " K (R² = " << prediction.fit_r2 << ")\n";
+    }
 }
 
 void displayGraph(Sample &sample) {
@@ -276,37 +1184,5969 @@ void displayGraph(Sample &sample) {
     }
 }
 
-void saveToFile(Sample &sample) {
+void saveToFile(Sample &sample, const RunResult &result) {
     string filename = sample.name + "_results.txt";
     // Remove spaces from filename
     for (size_t i = 0; i < filename.length(); i++) {
         if (filename[i] == ' ') filename[i] = '_';
     }
     
-    ofstream file(filename.c_str());  // Using c_str() for older compilers
-    if (!file.is_open()) {
-        cout << "\nError: Could not create file for saving results.\n";
-        return;
-    }
-    
     double C0 = epsilon_0 * 1e12 * (sample.area_mm2 / sample.thickness_mm); // Convert to pF
     
-    file << "Dielectric Constant Measurement Results\n";
-    file << "Material: " << sample.name << "\n";
-    file << "Sample dimensions: " << sqrt(sample.area_mm2) << " mm × " << sqrt(sample.area_mm2) << " mm × " 
-         << sample.thickness_mm << " mm\n";
-    file << "Vacuum capacitance (C0): " << C0 << " pF\n\n";
+    if (report_format != REPORT_JSON_LINES) {
+        ofstream file(filename.c_str());  // Using c_str() for older compilers
+        if (!file.is_open()) {
+            cout << "\nError: Could not create file for saving results.\n";
+            return;
+        }
+        
+        file << "Dielectric Constant Measurement Results\n";
+        file << "Material: " << sample.name << "\n";
+        file << "Sample dimensions: " << sqrt(sample.area_mm2) << " mm × " << sqrt(sample.area_mm2) << " mm × " 
+             << sample.thickness_mm << " mm\n";
+        file << "Vacuum capacitance (C0): " << C0 << " pF\n\n";
+        
+        file << "Temperature (°C)\tCapacitance (pF)\tDielectric Constant (ε)\n";
+        file << "--------------------------------------------------------\n";
+        
+        for (size_t i = 0; i < sample.temp_capacitance_data.size(); i++) {
+            int temp = sample.temp_capacitance_data[i].first;
+            double C = sample.temp_capacitance_data[i].second;
+            double epsilon = C / C0;
+            file << temp << "\t\t" << C << "\t\t" << epsilon << "\n";
+        }
+        
+        file.close();
+        cout << "\nResults saved to '" << filename << "'.\n";
+    }
     
-    file << "Temperature (°C)\tCapacitance (pF)\tDielectric Constant (ε)\n";
-    file << "--------------------------------------------------------\n";
+    if (report_format != REPORT_TEXT) {
+        string json_file = filename.substr(0, filename.size() - 4) + ".jsonl";
+        ofstream out(json_file.c_str(), ios::binary);
+        JsonLinesWriter writer;
+        jsonOpen(writer, out);
+        writeJsonLinesReport(writer, sample, result, -1);
+        if (jsonFlush(writer)) cout << "\nResults saved to '" << json_file << "' (JSON Lines).\n";
+    }
     
+    if (!save_arrow_readings) return;
+    // Arrow copy of the readings, so analysis tools can map it instead of parsing the text
+    vector<int32_t> temperature;
+    vector<double> capacitance, epsilon;
     for (size_t i = 0; i < sample.temp_capacitance_data.size(); i++) {
-        int temp = sample.temp_capacitance_data[i].first;
-        double C = sample.temp_capacitance_data[i].second;
-        double epsilon = C / C0;
-        file << temp << "\t\t" << C << "\t\t" << epsilon << "\n";
+        temperature.push_back(sample.temp_capacitance_data[i].first);
+        capacitance.push_back(sample.temp_capacitance_data[i].second);
+        epsilon.push_back(sample.temp_capacitance_data[i].second / C0);
+    }
+    const ArrowColumn columns[] = {
+        {"temperature_C", ARROW_INT32, temperature.data(), 0},
+        {"capacitance_pF", ARROW_FLOAT64, capacitance.data(), 0},
+        {"epsilon_r", ARROW_FLOAT64, epsilon.data(), 0},
+    };
+    string arrow_file = filename.substr(0, filename.size() - 4) + ".arrow";
+    if (writeArrowIpc(arrow_file, vector<ArrowColumn>(columns, columns + 3), temperature.size(), temperature.size(), true)) {
+        cout << "Readings saved to '" << arrow_file << "' (Arrow IPC).\n";
+    }
+}
+
+double vacuumCapacitance(const Sample &sample) {
+    return epsilon_0 * 1e12 * (sample.area_mm2 / sample.thickness_mm); // Convert to pF
+}
+
+// Predicts the Curie temperature from a temperature-sorted sweep that may still be running.
+// Above the transition ε follows the Curie-Weiss law ε = C / (T - T0), so 1/ε is linear in T.
+// A straight-line fit of 1/ε over the readings past the peak confirms that the maximum is
+// the transition (and not noise) and gives T0 and C; the peak itself is refined with a
+// least-squares parabola through the readings around it. The uncertainty is the vertex
+// variance, propagated from the scatter of the readings, plus the resolution of readings
+// one step apart (T0 is a different quantity and does not enter it). The sweep may stop once the fit is good and the uncertainty is
+// within early_stop_tolerance_C, or within half a step for sweeps too coarse for that:
+// more readings past the peak cannot locate it more finely than the spacing around it.
+// Readings are reached through T(i) and C(i), so the same code serves Sample readings and
+// the caller-owned arrays of the C ABI.
+template <class Temperature, class Capacitance>
+CuriePrediction predictCurie(size_t count, double C0, Temperature T, Capacitance C) {
+    CuriePrediction result = {false, false, 0, 0, 0, 0, 0, 0, 0};
+    if (count < 3) return result;
+    
+    size_t peak = 0;
+    for (size_t i = 1; i < count; i++) {
+        if (C(i) > C(peak)) peak = i;
+    }
+    
+    result.points_after_peak = static_cast<int>(count - 1 - peak);
+    result.peak_temp_C = T(peak);
+    result.predicted_curie_C = T(peak);
+    
+    double peak_epsilon = C(peak) / C0;
+    double last_epsilon = C(count - 1) / C0;
+    if (result.points_after_peak < early_stop_min_points ||
+        last_epsilon > peak_epsilon * (1.0 - early_stop_min_drop)) {
+        return result;
+    }
+    result.peak_passed = true;
+    
+    // Least-squares parabola through the readings within two steps of the peak, in
+    // temperatures relative to the peak. M is the inverse of the normal matrix, kept for
+    // the variance of the vertex.
+    size_t lo = peak >= 2 ? peak - 2 : 0, hi = min(count - 1, peak + 2);
+    double T_peak = T(peak);
+    double S[5] = {0, 0, 0, 0, 0}, Sy[3] = {0, 0, 0};
+    for (size_t i = lo; i <= hi; i++) {
+        double x = T(i) - T_peak, y = C(i), xk = 1;
+        for (int k = 0; k < 5; k++, xk *= x) {
+            S[k] += xk;
+            if (k < 3) Sy[k] += xk * y;
+        }
+    }
+    double N[3][3] = {{S[4], S[3], S[2]}, {S[3], S[2], S[1]}, {S[2], S[1], S[0]}};
+    double M[3][3];
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            M[c][r] = N[(r + 1) % 3][(c + 1) % 3] * N[(r + 2) % 3][(c + 2) % 3] -
+                      N[(r + 1) % 3][(c + 2) % 3] * N[(r + 2) % 3][(c + 1) % 3];
+        }
+    }
+    double det = N[0][0] * M[0][0] + N[0][1] * M[1][0] + N[0][2] * M[2][0];
+    double a = 0, b = 0, c0 = 0, vertex = 0;
+    bool has_vertex = false;
+    if (det != 0) {
+        for (int k = 0; k < 3; k++) {
+            for (int j = 0; j < 3; j++) M[k][j] /= det;
+        }
+        a = M[0][0] * Sy[2] + M[0][1] * Sy[1] + M[0][2] * Sy[0];
+        b = M[1][0] * Sy[2] + M[1][1] * Sy[1] + M[1][2] * Sy[0];
+        c0 = M[2][0] * Sy[2] + M[2][1] * Sy[1] + M[2][2] * Sy[0];
+        vertex = a < 0 ? -b / (2 * a) : 0;
+        has_vertex = a < 0 && vertex > T(lo) - T_peak && vertex < T(hi) - T_peak;
+        if (has_vertex) result.predicted_curie_C = T_peak + vertex;
+    }
+    
+    // Least-squares fit of 1/ε = a + b*T over the readings above the peak
+    int n = 0;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+    for (size_t i = peak + 1; i < count; i++) {
+        double x = T(i);
+        double y = C0 / C(i);
+        n++;
+        sx += x; sy += y; sxx += x * x; sxy += x * y; syy += y * y;
+    }
+    double mean_x = sx / n, mean_y = sy / n;
+    double var_x = sxx - n * mean_x * mean_x;
+    double var_y = syy - n * mean_y * mean_y;
+    double cov_xy = sxy - n * mean_x * mean_y;
+    if (var_x <= 0 || var_y <= 0 || cov_xy <= 0) return result;
+    
+    double slope = cov_xy / var_x;
+    double intercept = mean_y - slope * mean_x;
+    result.curie_constant = 1.0 / slope;
+    result.curie_weiss_T0_C = -intercept / slope;
+    result.fit_r2 = (cov_xy * cov_xy) / (var_x * var_y);
+    
+    // Relative scatter of the readings about the fit, only defined for n > 2
+    double relative_var = 0;
+    if (n > 2) {
+        for (size_t i = peak + 1; i < count; i++) {
+            double fitted = intercept + slope * T(i);
+            double r = (C0 / C(i) - fitted) / fitted;
+            relative_var += r * r / (n - 2);
+        }
+    }
+    
+    // Capacitance noise at the peak: the Curie-Weiss scatter scaled to the peak reading,
+    // or the parabola's own residuals if larger (they also carry its misfit to the cusp)
+    double noise_var = relative_var * C(peak) * C(peak);
+    size_t window = hi - lo + 1;
+    if (window > 3) {
+        double rss = 0;
+        for (size_t i = lo; i <= hi; i++) {
+            double x = T(i) - T_peak, r = C(i) - (a * x * x + b * x + c0);
+            rss += r * r;
+        }
+        noise_var = max(noise_var, rss / (window - 3));
+    }
+    
+    // Vertex -b/2a by the delta method. Readings one step apart place the peak only to
+    // within the step, which also bounds the parabola's bias on the cusp; without a vertex
+    // that is all that is known.
+    double step = (T(hi) - T(lo)) / (window - 1);
+    double vertex_var = step * step / 12.0;
+    if (has_vertex) {
+        vertex_var += max(0.0, noise_var * (vertex * vertex * M[0][0] + M[1][1] / 4 + vertex * M[0][1]) / (a * a));
+    }
+    result.uncertainty_C = sqrt(vertex_var);
+    
+    result.can_stop = result.fit_r2 >= early_stop_min_r2 &&
+                      result.uncertainty_C <= max(early_stop_tolerance_C, early_stop_tolerance_steps * step);
+    return result;
+}
+
+CuriePrediction predictCurieTemperature(const Sample &sample) {
+    const vector<pair<int, double>> &data = sample.temp_capacitance_data;
+    return predictCurie(data.size(), vacuumCapacitance(sample),
+                        [&](size_t i) { return static_cast<double>(data[i].first); },
+                        [&](size_t i) { return data[i].second; });
+}
+
+void advancedTools() {
+    int choice;
+    do {
+        cout << "\n===== Advanced Analysis Tools =====\n";
+        cout << "1. Evaluate Early Curie Prediction (synthetic sweeps)\n";
+        cout << "2. Analyze Multiplexed Plate Run (from file)\n";
+        cout << "3. Van der Pauw Resistivity and Hall Analysis (from file)\n";
+        cout << "4. Temperature-Dependent Hall Analysis (from file)\n";
+        cout << "5. Fit Dopant Model by Charge Neutrality (from file)\n";
+        cout << "6. Mobility Spectrum Analysis of Magnetoresistance (from file)\n";
+        cout << "7. Two-Carrier Model Fit of Magnetoresistance (from file)\n";
+        cout << "8. Load Material Classifier Tree (from file)\n";
+        cout << "9. Benchmark Material Classifier\n";
+        cout << "10. Identify Dielectrics by Nearest Reference (from files)\n";
+        cout << "11. Identify Samples from Dielectric + Hall Records (from files)\n";
+        cout << "12. Evaluate Classifier and Fused Identifier Accuracy and Throughput\n";
+        cout << "13. Cluster Stored Runs to Find Anomalous Lots\n";
+        cout << "14. Curie Temperature Process Control (EWMA/CUSUM)\n";
+        cout << "15. Query Stored Runs\n";
+        cout << "16. Daily Run Summaries\n";
+        cout << "17. Arrow IPC Export and Inspection\n";
+        cout << "18. Report Output Format\n";
+        cout << "19. Timeline Tracing (Chrome trace export)\n";
+        cout << "20. Latency Histograms\n";
+        cout << "21. Metrics Endpoint (Prometheus)\n";
+        cout << "22. Kernel Benchmark Suite (hardware counters)\n";
+        cout << "23. Performance Regression Gate\n";
+        cout << "24. Materials Database Snapshot\n";
+        cout << "0. Back\n";
+        cout << "Enter your choice: ";
+        
+        if (!(cin >> choice)) {
+            cout << "Invalid input. Please enter a number.\n";
+            clearInputBuffer();
+            continue;
+        }
+        
+        switch (choice) {
+            case 1: evaluateEarlyCuriePrediction(); break;
+            case 2: analyzeMultiplexedRun(); break;
+            case 3: analyzeVanDerPauwFile(); break;
+            case 4: analyzeHallSweepFile(); break;
+            case 5: fitChargeNeutralityFile(); break;
+            case 6: analyzeMobilitySpectrumFile(); break;
+            case 7: fitTwoCarrierFile(); break;
+            case 8: loadMaterialClassifier(); break;
+            case 9: benchmarkMaterialClassifier(); break;
+            case 10: identifyDielectricsKnn(); break;
+            case 11: identifyFusedRecords(); break;
+            case 12: evaluateMaterialClassifier(); break;
+            case 13: clusterRuns(); break;
+            case 14: showSpcCharts(); break;
+            case 15: queryRuns(); break;
+            case 16: showRollups(); break;
+            case 17: arrowTools(); break;
+            case 18: chooseReportFormat(); break;
+            case 19: traceTools(); break;
+            case 20: latencyTools(); break;
+            case 21: metricsTools(); break;
+            case 22: benchmarkSuite(); break;
+            case 23: regressionGate(); break;
+            case 24: materialsSnapshotTools(); break;
+            case 0: break;
+            default: cout << "Invalid choice. Try again.\n";
+        }
+    } while (choice != 0);
+}
+
+// Generates noisy synthetic sweeps of a ferroelectric with a known Curie temperature and
+// compares stopping at the first confident prediction against heating to the end.
+void evaluateEarlyCuriePrediction() {
+    const int trials = 1000;
+    const int start_temp = 25, end_offset = 80, step = 2;
+    const double noise = 0.01; // 1% relative capacitance noise
+    
+    mt19937 rng(12345);
+    uniform_real_distribution<double> curie_dist(60.0, 160.0);
+    normal_distribution<double> noise_dist(0.0, noise);
+    
+    Sample sample = builtinMaterials().find("Barium Titanate")->second;
+    double C0 = vacuumCapacitance(sample);
+    
+    int stopped = 0, early_covered = 0, full_covered = 0;
+    double saved_fraction_sum = 0, early_error_sum = 0, full_error_sum = 0, worst_error = 0;
+    double early_sigma_sum = 0, full_sigma_sum = 0;
+    
+    for (int trial = 0; trial < trials; trial++) {
+        double true_curie = curie_dist(rng);
+        double T0 = true_curie - 10.0;       // first-order transition: T0 below Tc
+        double peak_epsilon = 3000.0;
+        double curie_constant = peak_epsilon * (true_curie - T0);
+        int end_temp = static_cast<int>(true_curie) + end_offset;
+        
+        sample.temp_capacitance_data.clear();
+        double early_estimate = 0, early_sigma = 0;
+        int stop_temp = end_temp;
+        bool has_stopped = false;
+        
+        for (int T = start_temp; T <= end_temp; T += step) {
+            double epsilon;
+            if (T < true_curie) {
+                epsilon = 200.0 + (peak_epsilon - 200.0) * exp(-(true_curie - T) / 15.0);
+            } else {
+                epsilon = curie_constant / (T - T0);
+            }
+            epsilon *= 1.0 + noise_dist(rng);
+            sample.temp_capacitance_data.push_back(make_pair(T, epsilon * C0));
+            
+            if (!has_stopped) {
+                CuriePrediction prediction = predictCurieTemperature(sample);
+                if (prediction.can_stop) {
+                    has_stopped = true;
+                    stop_temp = T;
+                    early_estimate = prediction.predicted_curie_C;
+                    early_sigma = prediction.uncertainty_C;
+                }
+            }
+        }
+        
+        CuriePrediction full = predictCurieTemperature(sample);
+        double full_error = abs(full.predicted_curie_C - true_curie);
+        full_error_sum += full_error;
+        full_sigma_sum += full.uncertainty_C;
+        full_covered += full_error <= 2 * full.uncertainty_C;
+        
+        if (has_stopped) {
+            double early_error = abs(early_estimate - true_curie);
+            stopped++;
+            saved_fraction_sum += static_cast<double>(end_temp - stop_temp) / (end_temp - start_temp);
+            early_error_sum += early_error;
+            early_sigma_sum += early_sigma;
+            early_covered += early_error <= 2 * early_sigma;
+            worst_error = max(worst_error, early_error);
+        } else {
+            early_error_sum += full_error;
+            early_sigma_sum += full.uncertainty_C;
+            early_covered += full_error <= 2 * full.uncertainty_C;
+            worst_error = max(worst_error, full_error);
+        }
     }
     
-    file.close();
-    cout << "\nResults saved to '" << filename << "'.\n";
-}
\ No newline at end of file
+    cout << fixed << setprecision(2);
+    cout << "\n------ EARLY CURIE PREDICTION (" << trials << " synthetic sweeps) ------\n";
+    cout << "Sweeps stopped early: " << stopped << " / " << trials << "\n";
+    cout << "Mean heating time saved: " << 100.0 * saved_fraction_sum / trials << " %\n";
+    cout << "Mean |error| with early stop: " << early_error_sum / trials << "°C\n";
+    cout << "Mean |error| with full sweep: " << full_error_sum / trials << "°C\n";
+    cout << "Worst |error| with early stop: " << worst_error << "°C\n";
+    cout << "Mean reported 1-sigma: " << early_sigma_sum / trials << "°C early, " << full_sigma_sum / trials << "°C full\n";
+    cout << "Truth within 2 sigma: " << 100.0 * early_covered / trials << " % early, "
+         << 100.0 * full_covered / trials << " % full\n";
+}
+
+RunResult computeRunResult(const Sample &sample) {
+    RunResult result;
+    result.name = sample.name;
+    result.num_readings = sample.temp_capacitance_data.size();
+    result.C0 = vacuumCapacitance(sample);
+    result.peak_epsilon = 0;
+    result.peak_temp = 0;
+    for (size_t i = 0; i < sample.temp_capacitance_data.size(); i++) {
+        double epsilon = sample.temp_capacitance_data[i].second / result.C0;
+        if (epsilon > result.peak_epsilon) {
+            result.peak_epsilon = epsilon;
+            result.peak_temp = sample.temp_capacitance_data[i].first;
+        }
+    }
+    result.prediction = predictCurieTemperature(sample);
+    return result;
+}
+
+// Analyses every sample on the worker pool. Results keep the input order,
+// and nothing is printed from the workers. Traced and timed here rather than inside
+// computeRunResult, whose other callers run it within stages of their own.
+vector<RunResult> analyzeSamplesConcurrently(const vector<Sample> &samples) {
+    vector<RunResult> results(samples.size());
+    parallelFor(samples.size(), [&](size_t i) {
+        TraceScope trace("sample analysis");
+        LatencyTimer timer(LATENCY_SAMPLE_ANALYSIS);
+        results[i] = computeRunResult(samples[i]);
+    });
+    countMetric(METRIC_RUNS_ANALYZED, samples.size());
+    return results;
+}
+
+// Plate file format:
+//   channel <id> <material name>      assigns a material to a scanner channel
+//   <id> <temp °C> <capacitance pF>   one reading, in acquisition order
+// Lines starting with '#' are comments.
+bool loadMultiplexedRun(const string &filename, MultiplexedRun &run) {
+    ifstream file(filename.c_str());
+    if (!file.is_open()) {
+        cout << "\nError: Could not open '" << filename << "'.\n";
+        return false;
+    }
+    // Counted here rather than in the parser, which the benchmarks also run
+    if (!parseMultiplexedRun(file, run)) return false;
+    countMetric(METRIC_READINGS_INGESTED, run.readings.size());
+    return true;
+}
+
+bool parseMultiplexedRun(istream &file, MultiplexedRun &run) {
+    string line;
+    int line_number = 0, rejected = 0;
+    while (getline(file, line)) {
+        line_number++;
+        if (line.empty() || line[0] == '#') continue;
+        
+        istringstream in(line);
+        string first;
+        in >> first;
+        if (first == "channel") {
+            int channel;
+            string material;
+            Sample known;
+            if (in >> channel && getline(in >> ws, material) &&
+                channel >= 1 && channel <= max_mux_channels && findMaterial(material, known)) {
+                run.channel_materials[channel] = material;
+            } else {
+                cout << "Line " << line_number << ": invalid channel assignment ignored.\n";
+            }
+            continue;
+        }
+        
+        MuxReading reading;
+        istringstream values(line);
+        if (!(values >> reading.channel >> reading.temp >> reading.capacitance) ||
+            reading.channel < 1 || reading.channel > max_mux_channels ||
+            reading.temp < -273 || reading.capacitance <= 0) {
+            rejected++;
+            continue;
+        }
+        run.readings.push_back(reading);
+    }
+    
+    if (rejected > 0) cout << rejected << " invalid reading line(s) skipped.\n";
+    return true;
+}
+
+// Splits the interleaved stream into one temperature-sorted Sample per assigned channel
+map<int, Sample> demultiplexRun(const MultiplexedRun &run) {
+    map<int, Sample> samples;
+    for (map<int, string>::const_iterator it = run.channel_materials.begin(); it != run.channel_materials.end(); ++it) {
+        Sample sample;
+        findMaterial(it->second, sample);
+        samples[it->first] = sample;
+    }
+    
+    for (size_t i = 0; i < run.readings.size(); i++) {
+        map<int, Sample>::iterator it = samples.find(run.readings[i].channel);
+        if (it == samples.end()) continue; // channel without an assigned material
+        it->second.temp_capacitance_data.push_back(make_pair(run.readings[i].temp, run.readings[i].capacitance));
+    }
+    
+    for (map<int, Sample>::iterator it = samples.begin(); it != samples.end(); ++it) {
+        sort(it->second.temp_capacitance_data.begin(), it->second.temp_capacitance_data.end());
+    }
+    return samples;
+}
+
+void analyzeMultiplexedRun() {
+    string filename;
+    cout << "Plate run file: ";
+    clearInputBuffer();
+    getline(cin, filename);
+    
+    LatencyTimer timer(LATENCY_PLATE_RUN);
+    beginMemoryRun();
+    MultiplexedRun run;
+    vector<int> channels;
+    vector<Sample> samples;
+    {
+        TraceScope trace("ingest");
+        {
+            MemoryStageScope memory(MEMORY_INGEST);
+            if (!loadMultiplexedRun(filename, run)) return;
+        }
+        if (run.channel_materials.empty()) {
+            cout << "\nNo channels assigned in '" << filename << "'.\n";
+            return;
+        }
+        
+        MemoryStageScope memory(MEMORY_READINGS);
+        map<int, Sample> demuxed = demultiplexRun(run);
+        for (map<int, Sample>::iterator it = demuxed.begin(); it != demuxed.end(); ++it) {
+            channels.push_back(it->first);
+            samples.push_back(it->second);
+        }
+    }
+    
+    vector<RunResult> results;
+    {
+        MemoryStageScope memory(MEMORY_INTERMEDIATE);
+        results = analyzeSamplesConcurrently(samples);
+    }
+    {
+        TraceScope trace("save");
+        MemoryStageScope memory(MEMORY_OUTPUT);
+        vector<RunRecord> records;
+        for (size_t i = 0; i < results.size(); i++) {
+            RunRecord record;
+            if (makeRunRecord(samples[i], results[i], record)) records.push_back(record);
+        }
+        storeRuns(records);
+        
+        if (report_format != REPORT_TEXT) {
+            string json_file = filename.substr(0, filename.find_last_of('.')) + "_results.jsonl";
+            ofstream out(json_file.c_str(), ios::binary);
+            JsonLinesWriter writer;
+            jsonOpen(writer, out);
+            for (size_t i = 0; i < results.size(); i++) writeJsonLinesReport(writer, samples[i], results[i], channels[i]);
+            if (jsonFlush(writer)) cout << "\nResults saved to '" << json_file << "' (JSON Lines).\n";
+        }
+    }
+    
+    cout << fixed << setprecision(2);
+    cout << "\n------ PLATE RESULTS (" << run.readings.size() << " readings, " << channels.size() << " channels) ------\n";
+    cout << "Ch\tReadings\tPeak ε\t\tPeak T (°C)\tCurie T (°C)\t\tMaterial\n";
+    cout << "----------------------------------------------------------------------------------------\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const RunResult &r = results[i];
+        cout << channels[i] << "\t" << r.num_readings << "\t\t" << r.peak_epsilon << "\t\t" << r.peak_temp << "\t\t";
+        if (samples[i].curie_temp_C <= 0) {
+            cout << "n/a\t\t\t";
+        } else if (r.prediction.peak_passed) {
+            cout << r.prediction.predicted_curie_C << " ± " << r.prediction.uncertainty_C << "\t\t";
+        } else {
+            cout << "peak not passed\t\t";
+        }
+        cout << r.name << "\n";
+    }
+    printMemoryReport();
+}
+
+// Solves the van der Pauw equation exp(-π·RA/Rs) + exp(-π·RB/Rs) = 1 for many samples at
+// once. All lanes take the same Newton step each iteration (no per-sample branching), so
+// the inner loop vectorises; iteration ends when every lane has converged.
+void solveSheetResistanceBatch(const double *RA, const double *RB, double *Rs, unsigned char *converged, size_t n) {
+    const int max_iterations = 50;
+    const double tolerance = 1e-12;
+    
+    // Exact solution for the symmetric case RA == RB is a good start for all others
+    for (size_t i = 0; i < n; i++) {
+        Rs[i] = pi * (RA[i] + RB[i]) / (2.0 * log(2.0));
+        converged[i] = 0;
+    }
+    
+    for (int iteration = 0; iteration < max_iterations; iteration++) {
+        double worst = 0;
+        for (size_t i = 0; i < n; i++) {
+            double a = pi * RA[i] / Rs[i];
+            double b = pi * RB[i] / Rs[i];
+            double ea = exp(-a), eb = exp(-b);
+            double f = ea + eb - 1.0;
+            double df = (a * ea + b * eb) / Rs[i];
+            double step = f / df;
+            Rs[i] -= step;
+            double relative = fabs(step) / Rs[i];
+            converged[i] = relative < tolerance;
+            worst = max(worst, relative);
+        }
+        if (worst < tolerance) break;
+    }
+}
+
+vector<HallResult> analyzeVanDerPauwBatch(const vector<VanDerPauwMeasurement> &measurements) {
+    size_t n = measurements.size();
+    vector<double> RA(n), RB(n), Rs(n);
+    vector<unsigned char> converged(n);
+    
+    // Average reciprocal and reversed-polarity configurations for each direction
+    for (size_t i = 0; i < n; i++) {
+        const double *R = measurements[i].R;
+        RA[i] = (R[0] + R[1] + R[4] + R[5]) / 4.0;
+        RB[i] = (R[2] + R[3] + R[6] + R[7]) / 4.0;
+    }
+    solveSheetResistanceBatch(&RA[0], &RB[0], &Rs[0], &converged[0], n);
+    
+    vector<HallResult> results(n);
+    for (size_t i = 0; i < n; i++) {
+        const VanDerPauwMeasurement &m = measurements[i];
+        HallResult &r = results[i];
+        double thickness_cm = m.thickness_mm / 10.0;
+        
+        // Field reversal removes the misalignment offset from each diagonal voltage
+        const double *V = m.V_hall;
+        double V_H = ((V[0] - V[4]) + (V[1] - V[5]) + (V[2] - V[6]) + (V[3] - V[7])) / 8.0;
+        double IB = m.current_A * m.field_T;
+        
+        r.sample_id = m.sample_id;
+        r.converged = converged[i] != 0;
+        r.sheet_resistance = Rs[i];
+        r.resistivity = Rs[i] * thickness_cm;
+        r.sheet_density = IB / (electron_charge * fabs(V_H)) * 1e-4; // m⁻² -> cm⁻²
+        r.carrier_density = r.sheet_density / thickness_cm;
+        r.hall_coefficient = (V_H > 0 ? 1.0 : -1.0) / (electron_charge * r.carrier_density);
+        r.mobility = fabs(r.hall_coefficient) / r.resistivity;
+    }
+    return results;
+}
+
+// One measurement per line:
+//   <id> <thickness mm> <current A> <field T> <8 resistances Ω> <8 Hall voltages V>
+bool loadVanDerPauwMeasurements(const string &filename, vector<VanDerPauwMeasurement> &measurements) {
+    ifstream file(filename.c_str());
+    if (!file.is_open()) {
+        cout << "\nError: Could not open '" << filename << "'.\n";
+        return false;
+    }
+    
+    string line;
+    int rejected = 0;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream in(line);
+        VanDerPauwMeasurement m;
+        bool ok = static_cast<bool>(in >> m.sample_id >> m.thickness_mm >> m.current_A >> m.field_T);
+        for (int k = 0; k < 8 && ok; k++) ok = static_cast<bool>(in >> m.R[k]) && m.R[k] > 0;
+        for (int k = 0; k < 8 && ok; k++) ok = static_cast<bool>(in >> m.V_hall[k]);
+        if (!ok || m.thickness_mm <= 0 || m.current_A == 0 || m.field_T == 0) {
+            rejected++;
+            continue;
+        }
+        measurements.push_back(m);
+    }
+    
+    if (rejected > 0) cout << rejected << " invalid measurement line(s) skipped.\n";
+    return true;
+}
+
+void analyzeVanDerPauwFile() {
+    string filename;
+    cout << "Van der Pauw measurement file: ";
+    clearInputBuffer();
+    getline(cin, filename);
+    
+    vector<VanDerPauwMeasurement> measurements;
+    if (!loadVanDerPauwMeasurements(filename, measurements)) return;
+    if (measurements.empty()) {
+        cout << "\nNo measurements found in '" << filename << "'.\n";
+        return;
+    }
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<HallResult> results = analyzeVanDerPauwBatch(measurements);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    const size_t max_rows = 20;
+    cout << scientific << setprecision(3);
+    cout << "\n------ VAN DER PAUW / HALL RESULTS ------\n";
+    cout << "Sample\t\tRs (Ω/sq)\tρ (Ω·cm)\tR_H (cm³/C)\tn (cm⁻³)\tμ (cm²/V·s)\tType\n";
+    cout << "------------------------------------------------------------------------------------------------\n";
+    for (size_t i = 0; i < results.size() && i < max_rows; i++) {
+        const HallResult &r = results[i];
+        cout << r.sample_id << "\t\t" << r.sheet_resistance << "\t" << r.resistivity << "\t"
+             << r.hall_coefficient << "\t" << r.carrier_density << "\t" << r.mobility << "\t"
+             << (r.hall_coefficient > 0 ? "holes" : "electrons") << (r.converged ? "" : " (not converged)") << "\n";
+    }
+    if (results.size() > max_rows) cout << "... " << results.size() - max_rows << " more\n";
+    
+    cout << fixed << setprecision(0);
+    cout << "\nSolved " << results.size() << " wafers in " << seconds * 1e3 << " ms ("
+         << results.size() / max(seconds, 1e-9) << " wafers/s)\n";
+}
+
+// Prefix sums that give the least-squares line through any run of points in O(1)
+struct LineFitSums {
+    vector<double> sx, sy, sxx, sxy, syy;
+    
+    LineFitSums(const vector<double> &x, const vector<double> &y)
+        : sx(x.size() + 1, 0), sy(x.size() + 1, 0), sxx(x.size() + 1, 0), sxy(x.size() + 1, 0), syy(x.size() + 1, 0) {
+        for (size_t i = 0; i < x.size(); i++) {
+            sx[i + 1] = sx[i] + x[i];
+            sy[i + 1] = sy[i] + y[i];
+            sxx[i + 1] = sxx[i] + x[i] * x[i];
+            sxy[i + 1] = sxy[i] + x[i] * y[i];
+            syy[i + 1] = syy[i] + y[i] * y[i];
+        }
+    }
+    
+    // Slope and residual sum of squares of points [first, last]
+    void fit(size_t first, size_t last, double &slope, double &sse) const {
+        double n = static_cast<double>(last - first + 1);
+        double mx = (sx[last + 1] - sx[first]) / n, my = (sy[last + 1] - sy[first]) / n;
+        double vxx = (sxx[last + 1] - sxx[first]) - n * mx * mx;
+        double vxy = (sxy[last + 1] - sxy[first]) - n * mx * my;
+        double vyy = (syy[last + 1] - syy[first]) - n * my * my;
+        slope = vxx > 0 ? vxy / vxx : 0;
+        sse = max(0.0, vyy - slope * vxy);
+    }
+};
+
+// Slope of ln(n · T^-power) against 1000/T over [first, last]. Removing the T^3/2 of the
+// band density of states (T^3/4 in freeze-out) turns the slope into a clean activation energy.
+// A non-zero background (the ionised dopant density) is taken out with ni² = n(n - N) so
+// the onset of intrinsic conduction does not flatten the band-gap slope.
+static double arrheniusActivation(const HallSweepResult &r, size_t first, size_t last, double power, double background) {
+    vector<double> x, y;
+    for (size_t i = first; i <= last; i++) {
+        double T = 1000.0 / r.inverse_temp[i];
+        double density = r.carrier_density[i];
+        if (background > 0) {
+            if (density < 1.5 * background) continue;
+            density = sqrt(density * (density - background));
+        }
+        x.push_back(r.inverse_temp[i]);
+        y.push_back(log(density) - power * log(T));
+    }
+    if (x.size() < 2) return 0;
+    LineFitSums sums(x, y);
+    double slope, sse;
+    sums.fit(0, x.size() - 1, slope, sse);
+    return -slope * 1000.0 * boltzmann_eV;
+}
+
+// Splits ln n vs 1000/T into one to three straight regions (chosen by BIC), labels each
+// by its activation energy, and extracts the band gap (intrinsic, n ∝ T^3/2 exp(-Eg/2kT))
+// and the dopant ionisation energy (freeze-out, n ∝ T^3/4 exp(-Ed/2kT)).
+HallSweepResult analyzeHallSweep(const HallSweep &sweep) {
+    HallSweepResult r;
+    r.sample_id = sweep.sample_id;
+    r.band_gap_eV = 0;
+    r.ionization_eV = 0;
+    r.saturation_density = 0;
+    r.holes = false;
+    
+    const vector<pair<double, double>> &data = sweep.temp_hall_data;
+    size_t n = data.size();
+    vector<double> ln_n(n);
+    for (size_t i = 0; i < n; i++) {
+        r.inverse_temp.push_back(1000.0 / data[i].first);
+        r.carrier_density.push_back(1.0 / (electron_charge * fabs(data[i].second)));
+        ln_n[i] = log(r.carrier_density[i]);
+    }
+    if (n < min_arrhenius_points) return r;
+    
+    // Best breakpoints for 1, 2 and 3 segments, each at least min_arrhenius_points long
+    LineFitSums sums(r.inverse_temp, ln_n);
+    const size_t m = min_arrhenius_points;
+    double slope, sse_a, sse_b, sse_c;
+    sums.fit(0, n - 1, slope, sse_a);
+    double best_bic = n * log(max(sse_a, 1e-300) / n) + 2 * log(static_cast<double>(n));
+    size_t best_i = n, best_j = n; // no breaks
+    
+    for (size_t i = m; i + m <= n; i++) {
+        sums.fit(0, i - 1, slope, sse_a);
+        sums.fit(i, n - 1, slope, sse_b);
+        double bic = n * log(max(sse_a + sse_b, 1e-300) / n) + 5 * log(static_cast<double>(n));
+        if (bic < best_bic) { best_bic = bic; best_i = i; best_j = n; }
+        
+        for (size_t j = i + m; j + m <= n; j++) {
+            sums.fit(i, j - 1, slope, sse_b);
+            sums.fit(j, n - 1, slope, sse_c);
+            bic = n * log(max(sse_a + sse_b + sse_c, 1e-300) / n) + 8 * log(static_cast<double>(n));
+            if (bic < best_bic) { best_bic = bic; best_i = i; best_j = j; }
+        }
+    }
+    
+    vector<size_t> bounds;
+    bounds.push_back(0);
+    if (best_i < n) bounds.push_back(best_i);
+    if (best_j < n) bounds.push_back(best_j);
+    bounds.push_back(n);
+    
+    for (size_t k = 0; k + 1 < bounds.size(); k++) {
+        ArrheniusSegment seg;
+        seg.first = bounds[k];
+        seg.last = bounds[k + 1] - 1;
+        seg.activation_eV = arrheniusActivation(r, seg.first, seg.last, 0.0, 0);
+        if (fabs(seg.activation_eV) < extrinsic_max_activation_eV) seg.regime = REGIME_EXTRINSIC;
+        else if (seg.activation_eV < 0) seg.regime = REGIME_ANOMALOUS;
+        else if (seg.activation_eV < freeze_out_max_activation_eV) seg.regime = REGIME_FREEZE_OUT;
+        else seg.regime = REGIME_INTRINSIC;
+        r.segments.push_back(seg);
+    }
+    
+    // Extract material parameters from the labelled regions. Intrinsic segments are
+    // merged into one range starting at the first of them.
+    size_t majority_index = 0, intrinsic_first = n;
+    for (size_t k = 0; k < r.segments.size(); k++) {
+        const ArrheniusSegment &seg = r.segments[k];
+        if (seg.regime == REGIME_INTRINSIC) {
+            intrinsic_first = min(intrinsic_first, seg.first);
+        } else if (seg.regime == REGIME_FREEZE_OUT) {
+            r.ionization_eV = 2.0 * arrheniusActivation(r, seg.first, seg.last, 0.75, 0);
+            majority_index = seg.last;
+        } else if (seg.regime == REGIME_EXTRINSIC) {
+            double sum = 0;
+            for (size_t i = seg.first; i <= seg.last; i++) sum += r.carrier_density[i];
+            r.saturation_density = sum / (seg.last - seg.first + 1);
+            majority_index = (seg.first + seg.last) / 2;
+        }
+    }
+    if (intrinsic_first < n) {
+        r.band_gap_eV = 2.0 * arrheniusActivation(r, intrinsic_first, n - 1, 1.5, r.saturation_density);
+    }
+    r.holes = data[majority_index].second > 0;
+    return r;
+}
+
+vector<HallSweepResult> analyzeHallSweepsConcurrently(const vector<HallSweep> &sweeps) {
+    vector<HallSweepResult> results(sweeps.size());
+    parallelFor(sweeps.size(), [&](size_t i) {
+        results[i] = analyzeHallSweep(sweeps[i]);
+    });
+    return results;
+}
+
+// One reading per line: <sample id> <T K> <R_H cm³/C>. Readings of several samples may
+// be mixed; each sample is sorted by temperature after loading.
+bool loadHallSweeps(const string &filename, vector<HallSweep> &sweeps) {
+    ifstream file(filename.c_str());
+    if (!file.is_open()) {
+        cout << "\nError: Could not open '" << filename << "'.\n";
+        return false;
+    }
+    
+    map<string, size_t> index;
+    string line;
+    int rejected = 0;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream in(line);
+        string id;
+        double T, R_H;
+        if (!(in >> id >> T >> R_H) || T <= 0 || R_H == 0) {
+            rejected++;
+            continue;
+        }
+        if (!index.count(id)) {
+            index[id] = sweeps.size();
+            sweeps.push_back(HallSweep());
+            sweeps.back().sample_id = id;
+        }
+        sweeps[index[id]].temp_hall_data.push_back(make_pair(T, R_H));
+    }
+    
+    for (size_t i = 0; i < sweeps.size(); i++) {
+        sort(sweeps[i].temp_hall_data.begin(), sweeps[i].temp_hall_data.end());
+    }
+    if (rejected > 0) cout << rejected << " invalid reading line(s) skipped.\n";
+    return true;
+}
+
+void analyzeHallSweepFile() {
+    string filename;
+    cout << "Hall sweep file: ";
+    clearInputBuffer();
+    getline(cin, filename);
+    
+    vector<HallSweep> sweeps;
+    if (!loadHallSweeps(filename, sweeps)) return;
+    if (sweeps.empty()) {
+        cout << "\nNo readings found in '" << filename << "'.\n";
+        return;
+    }
+    
+    vector<HallSweepResult> results = analyzeHallSweepsConcurrently(sweeps);
+    const char *regime_names[] = {"freeze-out", "extrinsic", "intrinsic", "anomalous (density falls with T)"};
+    
+    cout << "\n------ TEMPERATURE-DEPENDENT HALL ANALYSIS ------\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const HallSweepResult &r = results[i];
+        const HallSweep &sweep = sweeps[i];
+        cout << "\nSample: " << r.sample_id << " (" << sweep.temp_hall_data.size() << " readings)\n";
+        if (r.segments.empty()) {
+            cout << "Not enough readings for an Arrhenius fit.\n";
+            continue;
+        }
+        for (size_t k = 0; k < r.segments.size(); k++) {
+            const ArrheniusSegment &seg = r.segments[k];
+            cout << fixed << setprecision(1) << "  " << sweep.temp_hall_data[seg.first].first << "-"
+                 << sweep.temp_hall_data[seg.last].first << " K: " << regime_names[seg.regime]
+                 << setprecision(4) << " (apparent Ea = " << seg.activation_eV << " eV)\n";
+        }
+        cout << "  Majority carriers: " << (r.holes ? "holes (p-type)" : "electrons (n-type)") << "\n";
+        if (r.saturation_density > 0) cout << scientific << setprecision(3) << "  Saturation density: " << r.saturation_density << " cm⁻³\n";
+        if (r.ionization_eV > 0) cout << fixed << setprecision(4) << "  Dopant ionisation energy: " << r.ionization_eV << " eV\n";
+        if (r.band_gap_eV > 0) cout << fixed << setprecision(3) << "  Band gap: " << r.band_gap_eV << " eV\n";
+        cout << "  Classification: "
+             << (r.saturation_density > 0 || r.ionization_eV > 0 ? "extrinsic semiconductor"
+                 : r.band_gap_eV > 0                             ? "intrinsic semiconductor"
+                                                                 : "undetermined (no regime could be fitted)") << "\n";
+    }
+}
+
+// ln of the normalised Fermi-Dirac integral F_1/2(η), using the Aymerich-Humet /
+// Bednarczyk closed form (better than 0.5% everywhere) so no quadrature is needed in the
+// solver loop. Evaluated in logs to avoid overflow and underflow far from the band.
+double logFermiDiracHalf(double eta) {
+    double a = eta * eta * eta * eta + 50.0 + 33.6 * eta * (1.0 - 0.68 * exp(-0.17 * (eta + 1.0) * (eta + 1.0)));
+    double log_b = log(0.75 * sqrt(pi)) - 0.375 * log(a);
+    return -eta > log_b ? eta - log1p(exp(eta + log_b)) : -log_b - log1p(exp(-eta - log_b));
+}
+
+// ln(1 + e^z) without overflow
+static inline double softplus(double z) {
+    return z > 0 ? z + log1p(exp(-z)) : log1p(exp(z));
+}
+
+// ln(e^x + e^y); an empty term is passed as -infinity
+static inline double logAddExp(double x, double y) {
+    double hi = max(x, y), lo = min(x, y);
+    return hi + log1p(exp(lo - hi));
+}
+
+// Net charge balance ln(p + Nd⁺) - ln(n + Na⁻) at Fermi level Ef (measured from the
+// valence band edge). Working in logs keeps every term finite at cryogenic temperatures
+// and makes the balance nearly linear in Ef, with slope about -1/kT.
+static inline double chargeBalance(double Ef, double kT, double Eg, double ln_Nc, double ln_Nv,
+                                   double ln_Nd, double ln_Na, const DopantParams &dopants) {
+    const double ln_g_donor = log(2.0), ln_g_acceptor = log(4.0);
+    double ln_electrons = ln_Nc + logFermiDiracHalf((Ef - Eg) / kT);
+    double ln_holes = ln_Nv + logFermiDiracHalf(-Ef / kT);
+    double ln_donors = ln_Nd - softplus((Ef - (Eg - dopants.Ed_eV)) / kT + ln_g_donor);
+    double ln_acceptors = ln_Na - softplus((dopants.Ea_eV - Ef) / kT + ln_g_acceptor);
+    return logAddExp(ln_holes, ln_donors) - logAddExp(ln_electrons, ln_acceptors);
+}
+
+// Solves p + Nd⁺ = n + Na⁻ for the Fermi level at every temperature in T[0..count).
+// The balance falls monotonically with E_F, so the root stays bracketed between a point
+// below the valence band and one above the conduction band. All temperatures take
+// Illinois (modified regula falsi) steps in lockstep until the widest update is tiny.
+void solveChargeNeutrality(const SemiconductorModel &model, const DopantParams &dopants, const double *T,
+                           double *Ef_minus_Ec, double *n, double *p, size_t count) {
+    const int max_iterations = 100;
+    const double tolerance = 1e-12; // eV
+    
+    // An absent dopant contributes ln(0) = -infinity, which logAddExp handles
+    const double ln_Nd = log(dopants.Nd), ln_Na = log(dopants.Na);
+    vector<double> kT(count), Eg(count), ln_Nc(count), ln_Nv(count), a(count), b(count), fa(count), fb(count);
+    for (size_t i = 0; i < count; i++) {
+        kT[i] = boltzmann_eV * T[i];
+        Eg[i] = model.Eg0_eV - model.varshni_alpha * T[i] * T[i] / (T[i] + model.varshni_beta);
+        ln_Nc[i] = log(2.509e19) + 1.5 * log(model.me_dos * T[i] / 300.0);
+        ln_Nv[i] = log(2.509e19) + 1.5 * log(model.mh_dos * T[i] / 300.0);
+        a[i] = -1.0;
+        b[i] = Eg[i] + 1.0;
+        fa[i] = chargeBalance(a[i], kT[i], Eg[i], ln_Nc[i], ln_Nv[i], ln_Nd, ln_Na, dopants);
+        fb[i] = chargeBalance(b[i], kT[i], Eg[i], ln_Nc[i], ln_Nv[i], ln_Nd, ln_Na, dopants);
+    }
+    
+    for (int iteration = 0; iteration < max_iterations; iteration++) {
+        double widest = 0;
+        for (size_t i = 0; i < count; i++) {
+            double c = fb[i] == 0 ? b[i] : b[i] - fb[i] * (b[i] - a[i]) / (fb[i] - fa[i]);
+            double fc = chargeBalance(c, kT[i], Eg[i], ln_Nc[i], ln_Nv[i], ln_Nd, ln_Na, dopants);
+            bool crossed = fc * fb[i] < 0;
+            a[i] = crossed ? b[i] : a[i];
+            fa[i] = crossed ? fb[i] : 0.5 * fa[i];
+            widest = max(widest, fabs(c - b[i]));
+            b[i] = c;
+            fb[i] = fc;
+        }
+        if (widest < tolerance) break;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        Ef_minus_Ec[i] = b[i] - Eg[i];
+        n[i] = exp(ln_Nc[i] + logFermiDiracHalf((b[i] - Eg[i]) / kT[i]));
+        p[i] = exp(ln_Nv[i] + logFermiDiracHalf(-b[i] / kT[i]));
+    }
+}
+
+// Sum of squared ln(n_model / n_measured) over a sweep; a single-carrier Hall
+// measurement sees the |n - p| excess carriers.
+static double dopantFitError(const SemiconductorModel &model, const DopantParams &params, const vector<double> &T,
+                             const vector<double> &ln_measured, vector<double> &Ef, vector<double> &n, vector<double> &p) {
+    size_t count = T.size();
+    solveChargeNeutrality(model, params, &T[0], &Ef[0], &n[0], &p[0], count);
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        double diff = log(max(fabs(n[i] - p[i]), 1.0)) - ln_measured[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+static DopantParams makeDopants(bool holes, double majority, double level, double compensation) {
+    const double compensating_level_eV = 0.045;
+    DopantParams params;
+    if (holes) {
+        params.Na = majority; params.Ea_eV = level;
+        params.Nd = compensation * majority; params.Ed_eV = compensating_level_eV;
+    } else {
+        params.Nd = majority; params.Ed_eV = level;
+        params.Na = compensation * majority; params.Ea_eV = compensating_level_eV;
+    }
+    return params;
+}
+
+// Fits majority dopant density, ionisation energy and compensation ratio to a measured
+// sweep by minimising the RMS ln-error. A coarse grid (quarter decades × 10 meV × three
+// compensation ratios) is spread over the worker pool, then the best cell is refined on a
+// finer local grid. Every candidate solves the whole sweep in one batch.
+DopantParams fitDopantsToHallSweep(const SemiconductorModel &model, const HallSweep &sweep, double &rms_log_error) {
+    const int density_steps = 33;      // 1e13 .. 1e21 cm⁻³
+    const int energy_steps = 30;       // 5 .. 295 meV
+    const double density_step = 0.25;  // decades
+    const double energy_step = 0.01;   // eV
+    const double compensations[] = {0.0, 0.1, 0.5};
+    const int compensation_steps = 3;
+    const int refine_steps = 9;
+    
+    size_t count = sweep.temp_hall_data.size();
+    rms_log_error = 0;
+    if (count == 0) return makeDopants(false, 0, 0, 0);
+    
+    vector<double> T(count), ln_measured(count);
+    for (size_t i = 0; i < count; i++) {
+        T[i] = sweep.temp_hall_data[i].first;
+        ln_measured[i] = -log(electron_charge * fabs(sweep.temp_hall_data[i].second));
+    }
+    bool holes = sweep.temp_hall_data[count / 2].second > 0;
+    
+    // Coarse grid, one density per work item
+    vector<double> cell_error(density_steps, numeric_limits<double>::max());
+    vector<int> cell_energy(density_steps), cell_compensation(density_steps);
+    parallelFor(density_steps, [&](size_t d) {
+        vector<double> Ef(count), n(count), p(count);
+        double majority = pow(10.0, 13.0 + density_step * d);
+        for (int e = 0; e < energy_steps; e++) {
+            for (int c = 0; c < compensation_steps; c++) {
+                DopantParams params = makeDopants(holes, majority, 0.005 + energy_step * e, compensations[c]);
+                double error = dopantFitError(model, params, T, ln_measured, Ef, n, p);
+                if (error < cell_error[d]) {
+                    cell_error[d] = error;
+                    cell_energy[d] = e;
+                    cell_compensation[d] = c;
+                }
+            }
+        }
+    });
+    
+    size_t best = 0;
+    for (int d = 1; d < density_steps; d++) {
+        if (cell_error[d] < cell_error[best]) best = d;
+    }
+    double best_log_density = 13.0 + density_step * best;
+    double best_level = 0.005 + energy_step * cell_energy[best];
+    double compensation = compensations[cell_compensation[best]];
+    
+    // Local refinement over ±one coarse step in density and energy
+    vector<double> refine_error(refine_steps, numeric_limits<double>::max());
+    vector<DopantParams> refine_params(refine_steps);
+    parallelFor(refine_steps, [&](size_t d) {
+        vector<double> Ef(count), n(count), p(count);
+        double majority = pow(10.0, best_log_density + density_step * (2.0 * d / (refine_steps - 1) - 1.0));
+        for (int e = 0; e < refine_steps; e++) {
+            double level = best_level + energy_step * (2.0 * e / (refine_steps - 1) - 1.0);
+            if (level <= 0) continue;
+            DopantParams params = makeDopants(holes, majority, level, compensation);
+            double error = dopantFitError(model, params, T, ln_measured, Ef, n, p);
+            if (error < refine_error[d]) {
+                refine_error[d] = error;
+                refine_params[d] = params;
+            }
+        }
+    });
+    
+    best = 0;
+    for (int d = 1; d < refine_steps; d++) {
+        if (refine_error[d] < refine_error[best]) best = d;
+    }
+    rms_log_error = sqrt(refine_error[best] / count);
+    return refine_params[best];
+}
+
+void fitChargeNeutralityFile() {
+    cout << "\nSemiconductor models:\n";
+    vector<string> keys;
+    for (map<string, SemiconductorModel>::iterator it = semiconductors.begin(); it != semiconductors.end(); ++it) {
+        cout << keys.size() + 1 << ". " << it->first << endl;
+        keys.push_back(it->first);
+    }
+    int model_choice;
+    cout << "Select a model (1-" << keys.size() << "): ";
+    while (!(cin >> model_choice) || model_choice < 1 || model_choice > static_cast<int>(keys.size())) {
+        cout << "Invalid selection. Please enter a number between 1 and " << keys.size() << ": ";
+        clearInputBuffer();
+    }
+    const SemiconductorModel &model = semiconductors[keys[model_choice - 1]];
+    
+    string filename;
+    cout << "Hall sweep file: ";
+    clearInputBuffer();
+    getline(cin, filename);
+    
+    vector<HallSweep> sweeps;
+    if (!loadHallSweeps(filename, sweeps)) return;
+    if (sweeps.empty()) {
+        cout << "\nNo readings found in '" << filename << "'.\n";
+        return;
+    }
+    
+    cout << "\n------ CHARGE-NEUTRALITY FIT (" << model.name << ") ------\n";
+    for (size_t i = 0; i < sweeps.size(); i++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        double rms;
+        DopantParams fit = fitDopantsToHallSweep(model, sweeps[i], rms);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        // Degenerate at room temperature when E_F sits inside a band
+        double room_T = 300.0, Ef_minus_Ec, n, p;
+        solveChargeNeutrality(model, fit, &room_T, &Ef_minus_Ec, &n, &p, 1);
+        double Eg_room = model.Eg0_eV - model.varshni_alpha * room_T * room_T / (room_T + model.varshni_beta);
+        bool holes = fit.Na > fit.Nd;
+        bool degenerate = holes ? (Ef_minus_Ec + Eg_room < 0) : (Ef_minus_Ec > 0);
+        
+        cout << "\nSample: " << sweeps[i].sample_id << "\n";
+        cout << scientific << setprecision(3);
+        cout << "  Nd = " << fit.Nd << " cm⁻³, Na = " << fit.Na << " cm⁻³\n";
+        cout << fixed << setprecision(4);
+        cout << "  " << (holes ? "Acceptor" : "Donor") << " ionisation energy: " << (holes ? fit.Ea_eV : fit.Ed_eV) << " eV\n";
+        cout << "  E_F - E_C at 300 K: " << Ef_minus_Ec << " eV\n";
+        cout << "  RMS ln-error: " << rms << "\n";
+        cout << "  Classification: " << (degenerate ? "heavily doped semiconductor / poor metal"
+                                                    : (holes ? "p-type semiconductor" : "n-type semiconductor")) << "\n";
+        cout << setprecision(2) << "  Grid search time: " << seconds << " s\n";
+    }
+}
+
+// Lawson-Hanson active-set NNLS, min |A·x - b| with x >= 0, worked entirely through the
+// normal equations: ws.gram holds AᵀA and ws.Atb holds Aᵀb on entry, ws.x gets the result.
+// Each passive-set subproblem is a Cholesky solve on the rows/columns of AᵀA in the set.
+void solveNnls(size_t columns, NnlsWorkspace &ws) {
+    const int max_iterations = static_cast<int>(3 * columns);
+    const double tolerance = 1e-12;
+    double *G = &ws.gram[0];
+    
+    for (size_t j = 0; j < columns; j++) {
+        ws.x[j] = 0;
+        ws.passive[j] = 0;
+    }
+    
+    for (int outer = 0; outer < max_iterations; outer++) {
+        // Gradient w = Aᵀb - AᵀA·x; stop when no zero variable wants to grow
+        size_t entering = columns;
+        double best = tolerance;
+        for (size_t j = 0; j < columns; j++) {
+            double w = ws.Atb[j];
+            for (size_t k = 0; k < columns; k++) w -= G[j * columns + k] * ws.x[k];
+            ws.w[j] = w;
+            if (!ws.passive[j] && w > best) {
+                best = w;
+                entering = j;
+            }
+        }
+        if (entering == columns) break;
+        ws.passive[entering] = 1;
+        
+        for (int inner = 0; inner < max_iterations; inner++) {
+            // Unconstrained least squares on the passive set
+            size_t m = 0;
+            for (size_t j = 0; j < columns; j++) {
+                if (ws.passive[j]) ws.passive_index[m++] = j;
+            }
+            double *L = &ws.cholesky[0];
+            bool singular = false;
+            for (size_t r = 0; r < m && !singular; r++) {
+                for (size_t c = 0; c <= r; c++) {
+                    double sum = G[ws.passive_index[r] * columns + ws.passive_index[c]];
+                    for (size_t k = 0; k < c; k++) sum -= L[r * m + k] * L[c * m + k];
+                    if (r == c) {
+                        if (sum <= 0) { singular = true; break; }
+                        L[r * m + r] = sqrt(sum);
+                    } else {
+                        L[r * m + c] = sum / L[c * m + c];
+                    }
+                }
+            }
+            if (singular) {
+                // Column is linearly dependent on the set; drop it for good
+                ws.passive[entering] = 0;
+                ws.w[entering] = 0;
+                break;
+            }
+            for (size_t r = 0; r < m; r++) {
+                double sum = ws.Atb[ws.passive_index[r]];
+                for (size_t k = 0; k < r; k++) sum -= L[r * m + k] * ws.z[k];
+                ws.z[r] = sum / L[r * m + r];
+            }
+            for (size_t r = m; r-- > 0;) {
+                double sum = ws.z[r];
+                for (size_t k = r + 1; k < m; k++) sum -= L[k * m + r] * ws.z[k];
+                ws.z[r] = sum / L[r * m + r];
+            }
+            
+            // Accept if feasible, otherwise step back to the boundary and drop zeros
+            double alpha = 1.0;
+            for (size_t r = 0; r < m; r++) {
+                if (ws.z[r] <= 0) {
+                    double xj = ws.x[ws.passive_index[r]];
+                    alpha = min(alpha, xj / (xj - ws.z[r]));
+                }
+            }
+            for (size_t r = 0; r < m; r++) {
+                size_t j = ws.passive_index[r];
+                ws.x[j] += alpha * (ws.z[r] - ws.x[j]);
+                if (alpha < 1.0 && ws.x[j] <= tolerance * fabs(ws.z[r]) + 1e-300) {
+                    ws.x[j] = 0;
+                    ws.passive[j] = 0;
+                }
+            }
+            if (alpha >= 1.0) break;
+        }
+    }
+}
+
+// Quantitative mobility spectrum: conductivity s(μ) ≥ 0 on a fixed signed mobility grid
+// such that σxx(B) = Σ s/(1 + μ²B²) and σxy(B) = Σ s·μB/(1 + μ²B²). Every equation is
+// scaled by σxx at that field so low- and high-field points weigh the same. Peaks of the
+// spectrum are reported as separate carrier species.
+MobilitySpectrum computeMobilitySpectrum(const MagnetoTransportSet &set, NnlsWorkspace &ws) {
+    const size_t columns = 2 * spectrum_points_per_sign;
+    const double ridge = 1e-10; // relative Tikhonov term, keeps AᵀA positive definite
+    
+    MobilitySpectrum spectrum;
+    spectrum.sample_id = set.sample_id;
+    spectrum.T_K = set.T_K;
+    spectrum.residual = 0;
+    
+    double log_min = log10(spectrum_min_mobility), log_max = log10(spectrum_max_mobility);
+    for (int k = 0; k < spectrum_points_per_sign; k++) {
+        double mu = pow(10.0, log_min + (log_max - log_min) * k / (spectrum_points_per_sign - 1));
+        spectrum.mobility.push_back(-mu);
+        spectrum.mobility.push_back(mu);
+    }
+    
+    // Build AᵀA and Aᵀb directly from the two equations at each field
+    ws.reserve(columns);
+    fill(ws.gram.begin(), ws.gram.end(), 0.0);
+    fill(ws.Atb.begin(), ws.Atb.end(), 0.0);
+    vector<double> &row_xx = ws.row_xx, &row_xy = ws.row_xy;
+    double b_norm = 0;
+    for (size_t f = 0; f < set.B.size(); f++) {
+        double scale = 1.0 / fabs(set.sigma_xx[f]);
+        for (size_t j = 0; j < columns; j++) {
+            double muB = spectrum.mobility[j] * 1e-4 * set.B[f]; // cm²/Vs -> m²/Vs
+            double d = 1.0 / (1.0 + muB * muB);
+            row_xx[j] = d * scale;
+            row_xy[j] = muB * d * scale;
+        }
+        double bxx = set.sigma_xx[f] * scale, bxy = set.sigma_xy[f] * scale;
+        b_norm += bxx * bxx + bxy * bxy;
+        for (size_t j = 0; j < columns; j++) {
+            ws.Atb[j] += row_xx[j] * bxx + row_xy[j] * bxy;
+            for (size_t k = 0; k <= j; k++) {
+                ws.gram[j * columns + k] += row_xx[j] * row_xx[k] + row_xy[j] * row_xy[k];
+            }
+        }
+    }
+    double trace = 0;
+    for (size_t j = 0; j < columns; j++) {
+        for (size_t k = 0; k < j; k++) ws.gram[k * columns + j] = ws.gram[j * columns + k];
+        trace += ws.gram[j * columns + j];
+    }
+    for (size_t j = 0; j < columns; j++) ws.gram[j * columns + j] += ridge * trace / columns;
+    
+    solveNnls(columns, ws);
+    spectrum.conductivity.assign(ws.x.begin(), ws.x.begin() + columns);
+    
+    // |Ax - b|² = xᵀAᵀAx - 2xᵀAᵀb + bᵀb
+    double fit = 0;
+    for (size_t j = 0; j < columns; j++) {
+        double Gx = 0;
+        for (size_t k = 0; k < columns; k++) Gx += ws.gram[j * columns + k] * ws.x[k];
+        fit += ws.x[j] * (Gx - 2 * ws.Atb[j]);
+    }
+    spectrum.residual = sqrt(max(0.0, fit + b_norm) / max(b_norm, 1e-300));
+    
+    // Group contiguous non-zero runs of each sign into carrier species
+    for (int sign = 0; sign < 2; sign++) {
+        CarrierSpecies current = {sign == 1, 0, 0, 0};
+        double weighted_log_mu = 0;
+        for (int k = 0; k <= spectrum_points_per_sign; k++) {
+            double s = k < spectrum_points_per_sign ? spectrum.conductivity[2 * k + sign] : 0;
+            if (s > 0) {
+                current.conductivity += s;
+                weighted_log_mu += s * log(fabs(spectrum.mobility[2 * k + sign]));
+            } else if (current.conductivity > 0) {
+                current.mobility = exp(weighted_log_mu / current.conductivity);
+                current.density = current.conductivity / (electron_charge * current.mobility);
+                spectrum.carriers.push_back(current);
+                current.conductivity = 0;
+                weighted_log_mu = 0;
+            }
+        }
+    }
+    return spectrum;
+}
+
+vector<MobilitySpectrum> computeMobilitySpectraConcurrently(const vector<MagnetoTransportSet> &sets) {
+    vector<MobilitySpectrum> spectra(sets.size());
+    vector<NnlsWorkspace> workspaces(workerCount(sets.size()), NnlsWorkspace(2 * spectrum_points_per_sign));
+    parallelForWorkers(sets.size(), [&](unsigned worker, size_t i) {
+        spectra[i] = computeMobilitySpectrum(sets[i], workspaces[worker]);
+    });
+    return spectra;
+}
+
+// One field point per line: <sample id> <T K> <B T> <σxx S/cm> <σxy S/cm>.
+// Points sharing a sample id and temperature form one spectrum.
+bool loadMagnetoTransportSets(const string &filename, vector<MagnetoTransportSet> &sets) {
+    ifstream file(filename.c_str());
+    if (!file.is_open()) {
+        cout << "\nError: Could not open '" << filename << "'.\n";
+        return false;
+    }
+    
+    map<pair<string, double>, size_t> index;
+    string line;
+    int rejected = 0;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream in(line);
+        string id;
+        double T, B, sxx, sxy;
+        if (!(in >> id >> T >> B >> sxx >> sxy) || T <= 0 || sxx <= 0) {
+            rejected++;
+            continue;
+        }
+        pair<string, double> key(id, T);
+        if (!index.count(key)) {
+            index[key] = sets.size();
+            sets.push_back(MagnetoTransportSet());
+            sets.back().sample_id = id;
+            sets.back().T_K = T;
+        }
+        MagnetoTransportSet &set = sets[index[key]];
+        set.B.push_back(B);
+        set.sigma_xx.push_back(sxx);
+        set.sigma_xy.push_back(sxy);
+    }
+    
+    if (rejected > 0) cout << rejected << " invalid line(s) skipped.\n";
+    return true;
+}
+
+void analyzeMobilitySpectrumFile() {
+    string filename;
+    cout << "Magnetotransport file: ";
+    clearInputBuffer();
+    getline(cin, filename);
+    
+    vector<MagnetoTransportSet> sets;
+    if (!loadMagnetoTransportSets(filename, sets)) return;
+    if (sets.empty()) {
+        cout << "\nNo field points found in '" << filename << "'.\n";
+        return;
+    }
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<MobilitySpectrum> spectra = computeMobilitySpectraConcurrently(sets);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    const size_t max_spectra = 20;
+    cout << "\n------ MOBILITY SPECTRUM ANALYSIS ------\n";
+    for (size_t i = 0; i < spectra.size() && i < max_spectra; i++) {
+        const MobilitySpectrum &sp = spectra[i];
+        cout << fixed << setprecision(1) << "\nSample: " << sp.sample_id << " at " << sp.T_K << " K ("
+             << sets[i].B.size() << " fields, residual " << setprecision(4) << sp.residual << ")\n";
+        for (size_t k = 0; k < sp.carriers.size(); k++) {
+            const CarrierSpecies &c = sp.carriers[k];
+            cout << scientific << setprecision(3) << "  " << (c.holes ? "holes    " : "electrons") << "  μ = " << c.mobility
+                 << " cm²/V·s  n = " << c.density << " cm⁻³  σ = " << c.conductivity << " S/cm\n";
+        }
+        if (sp.carriers.empty()) {
+            cout << "  No carriers resolved.\n";
+            continue;
+        }
+        
+        // Classify on the strongest species of each sign
+        double e_sigma = 0, e_density = 0, e_mobility = 0, h_sigma = 0, h_density = 0, h_mobility = 0;
+        for (size_t k = 0; k < sp.carriers.size(); k++) {
+            const CarrierSpecies &c = sp.carriers[k];
+            if (c.holes && c.conductivity > h_sigma) { h_sigma = c.conductivity; h_density = c.density; h_mobility = c.mobility; }
+            if (!c.holes && c.conductivity > e_sigma) { e_sigma = c.conductivity; e_density = c.density; e_mobility = c.mobility; }
+        }
+        cout << "  Classification: " << classifyCarriers(e_density, e_mobility, h_density, h_mobility) << "\n";
+    }
+    if (spectra.size() > max_spectra) cout << "\n... " << spectra.size() - max_spectra << " more spectra\n";
+    
+    cout << fixed << setprecision(0);
+    cout << "\nComputed " << spectra.size() << " spectra in " << seconds * 1e3 << " ms ("
+         << spectra.size() / max(seconds, 1e-9) << " spectra/s)\n";
+}
+
+// Carrier inputs are clamped to these before taking logs, so an absent or empty band
+// (zero density or mobility), a NaN or an infinity still gives finite features; one
+// -inf would otherwise turn a whole column's spread into NaN
+const double min_feature_density = 1.0, max_feature_density = 1e30;    // cm⁻³
+const double min_feature_mobility = 1e-6, max_feature_mobility = 1e8;  // cm²/(V·s)
+
+static double clampCarrierInput(double value, double low, double high) {
+    return value > low ? min(value, high) : low;  // NaN fails the comparison
+}
+
+// Feature vector (CarrierFeature order) for one electron and one hole population
+void carrierFeatures(double electron_density, double electron_mobility, double hole_density, double hole_mobility, double *x) {
+    electron_density = clampCarrierInput(electron_density, min_feature_density, max_feature_density);
+    hole_density = clampCarrierInput(hole_density, min_feature_density, max_feature_density);
+    electron_mobility = clampCarrierInput(electron_mobility, min_feature_mobility, max_feature_mobility);
+    hole_mobility = clampCarrierInput(hole_mobility, min_feature_mobility, max_feature_mobility);
+    double electron_sigma = electron_charge * electron_density * electron_mobility;
+    double hole_sigma = electron_charge * hole_density * hole_mobility;
+    bool holes = hole_sigma > electron_sigma;
+    x[FEATURE_LOG_CONDUCTIVITY] = log10(electron_sigma + hole_sigma);
+    x[FEATURE_LOG_MAJORITY_DENSITY] = log10(holes ? hole_density : electron_density);
+    x[FEATURE_MAJORITY_SIGN] = holes ? 1.0 : -1.0;
+    x[FEATURE_LOG_MAJORITY_MOBILITY] = log10(holes ? hole_mobility : electron_mobility);
+}
+
+// Maps fitted carrier populations onto the material classes with the active classifier
+string classifyCarriers(double electron_density, double electron_mobility, double hole_density, double hole_mobility) {
+    double x[NUM_CARRIER_FEATURES];
+    carrierFeatures(electron_density, electron_mobility, hole_density, hole_mobility, x);
+    unsigned char label;
+    classifyBatch(activeMaterialForest(), x, 1, &label);
+    return material_class_names[label];
+}
+
+// Levenberg-Marquardt fit of σxx(B), σxy(B) to one electron and one hole band. The
+// parameters are ln n, ln μn, ln p, ln μp, so they stay positive, and the Jacobian is
+// analytic: for a band with conductivity s = q·n·μ and x = μB,
+//   ∂σxx/∂ln n = σxx,   ∂σxx/∂ln μ = σxx·(1 - x²)/(1 + x²),
+//   ∂σxy/∂ln n = σxy,   ∂σxy/∂ln μ = σxy·2/(1 + x²).
+// Residuals are scaled by the measured σxx as in the mobility spectrum. A few starting
+// mobility pairs are tried and the best converged fit is kept.
+TwoCarrierFit fitTwoCarrierModel(const MagnetoTransportSet &set) {
+    const int max_iterations = 100;
+    const double tolerance = 1e-8;
+    const double start_mobilities[] = {1e2, 1e3, 1e4};
+    const double log_density_min = log(1e6), log_density_max = log(1e24);    // cm⁻³
+    const double log_mobility_min = log(1e-1), log_mobility_max = log(1e7);  // cm²/(V·s)
+    const double negligible_share = 1e-3; // of the total conductivity
+    
+    size_t m = set.B.size();
+    vector<double> x_e(m), x_h(m), d_e(m), d_h(m), r(m * 2), J(m * 2 * 4), scale(m);
+    double sigma_0 = set.sigma_xx[0];
+    for (size_t f = 0; f < m; f++) {
+        scale[f] = 1.0 / set.sigma_xx[f];
+        if (fabs(set.B[f]) < fabs(set.B[0])) sigma_0 = set.sigma_xx[f];
+    }
+    
+    TwoCarrierFit best;
+    best.sample_id = set.sample_id;
+    best.T_K = set.T_K;
+    best.residual = numeric_limits<double>::max();
+    best.converged = false;
+    best.iterations = 0;
+    best.electron_density = best.electron_mobility = best.hole_density = best.hole_mobility = 0;
+    
+    // Residuals and Jacobian for the whole field sweep at parameters p
+    auto evaluate = [&](const double *p, bool with_jacobian) {
+        double s_e = electron_charge * exp(p[0] + p[1]), mu_e = exp(p[1]) * 1e-4;
+        double s_h = electron_charge * exp(p[2] + p[3]), mu_h = exp(p[3]) * 1e-4;
+        double sum = 0;
+        for (size_t f = 0; f < m; f++) {
+            x_e[f] = mu_e * set.B[f];
+            x_h[f] = mu_h * set.B[f];
+            d_e[f] = 1.0 / (1.0 + x_e[f] * x_e[f]);
+            d_h[f] = 1.0 / (1.0 + x_h[f] * x_h[f]);
+            double xx_e = s_e * d_e[f], xx_h = s_h * d_h[f];
+            double xy_e = -s_e * x_e[f] * d_e[f], xy_h = s_h * x_h[f] * d_h[f];
+            r[2 * f] = (xx_e + xx_h - set.sigma_xx[f]) * scale[f];
+            r[2 * f + 1] = (xy_e + xy_h - set.sigma_xy[f]) * scale[f];
+            sum += r[2 * f] * r[2 * f] + r[2 * f + 1] * r[2 * f + 1];
+            if (with_jacobian) {
+                double *row_xx = &J[8 * f], *row_xy = &J[8 * f + 4];
+                row_xx[0] = xx_e * scale[f];
+                row_xx[1] = xx_e * (1.0 - x_e[f] * x_e[f]) * d_e[f] * scale[f];
+                row_xx[2] = xx_h * scale[f];
+                row_xx[3] = xx_h * (1.0 - x_h[f] * x_h[f]) * d_h[f] * scale[f];
+                row_xy[0] = xy_e * scale[f];
+                row_xy[1] = xy_e * 2.0 * d_e[f] * scale[f];
+                row_xy[2] = xy_h * scale[f];
+                row_xy[3] = xy_h * 2.0 * d_h[f] * scale[f];
+            }
+        }
+        return sum;
+    };
+    
+    for (int a = 0; a < 3; a++) {
+        for (int b = 0; b < 3; b++) {
+            // Split the zero-field conductivity evenly between the bands
+            double params[4] = {log(0.5 * sigma_0 / (electron_charge * start_mobilities[a])), log(start_mobilities[a]),
+                                log(0.5 * sigma_0 / (electron_charge * start_mobilities[b])), log(start_mobilities[b])};
+            double lambda = 1e-3;
+            double cost = evaluate(params, true);
+            bool converged = false;
+            int iteration = 0;
+            
+            for (; iteration < max_iterations && !converged; iteration++) {
+                double JtJ[16] = {0}, Jtr[4] = {0};
+                for (size_t row = 0; row < 2 * m; row++) {
+                    const double *j = &J[4 * row];
+                    for (int u = 0; u < 4; u++) {
+                        Jtr[u] += j[u] * r[row];
+                        for (int v = 0; v < 4; v++) JtJ[4 * u + v] += j[u] * j[v];
+                    }
+                }
+                
+                // Retry with more damping until the step lowers the cost
+                bool accepted = false;
+                while (!accepted && lambda < 1e12) {
+                    double A[16], step[4];
+                    for (int u = 0; u < 16; u++) A[u] = JtJ[u];
+                    for (int u = 0; u < 4; u++) {
+                        A[5 * u] += lambda * max(JtJ[5 * u], 1e-30);
+                        step[u] = -Jtr[u];
+                    }
+                    // Gaussian elimination on the 4x4 damped system (positive definite)
+                    for (int c = 0; c < 4; c++) {
+                        for (int row = c + 1; row < 4; row++) {
+                            double factor = A[4 * row + c] / A[5 * c];
+                            for (int k = c; k < 4; k++) A[4 * row + k] -= factor * A[4 * c + k];
+                            step[row] -= factor * step[c];
+                        }
+                    }
+                    for (int c = 3; c >= 0; c--) {
+                        for (int k = c + 1; k < 4; k++) step[c] -= A[4 * c + k] * step[k];
+                        step[c] /= A[5 * c];
+                    }
+                    
+                    // Keep densities and mobilities inside physical bounds so a vanishing
+                    // band cannot drift off to zero density and infinite mobility
+                    double trial[4];
+                    double step_size = 0;
+                    for (int u = 0; u < 4; u++) {
+                        trial[u] = params[u] + step[u];
+                        trial[u] = u % 2 == 0 ? min(max(trial[u], log_density_min), log_density_max)
+                                              : min(max(trial[u], log_mobility_min), log_mobility_max);
+                        step_size = max(step_size, fabs(trial[u] - params[u]));
+                    }
+                    double trial_cost = evaluate(trial, false);
+                    if (trial_cost < cost) {
+                        converged = (cost - trial_cost) < tolerance * cost || step_size < tolerance;
+                        for (int u = 0; u < 4; u++) params[u] = trial[u];
+                        cost = evaluate(params, true);
+                        lambda = max(lambda * 0.3, 1e-12);
+                        accepted = true;
+                    } else {
+                        lambda *= 10.0;
+                    }
+                }
+                if (!accepted) {
+                    converged = true; // no downhill step left: at a minimum
+                }
+            }
+            
+            double residual = sqrt(cost / (2.0 * m));
+            if (residual < best.residual) {
+                best.residual = residual;
+                best.converged = converged;
+                best.iterations = iteration;
+                best.electron_density = exp(params[0]);
+                best.electron_mobility = exp(params[1]);
+                best.hole_density = exp(params[2]);
+                best.hole_mobility = exp(params[3]);
+            }
+        }
+    }
+    
+    // A band carrying a negligible share of the conductivity is reported as absent
+    double electron_sigma = best.electron_density * best.electron_mobility;
+    double hole_sigma = best.hole_density * best.hole_mobility;
+    if (electron_sigma < negligible_share * (electron_sigma + hole_sigma)) {
+        best.electron_density = best.electron_mobility = 0;
+    }
+    if (hole_sigma < negligible_share * (electron_sigma + hole_sigma)) {
+        best.hole_density = best.hole_mobility = 0;
+    }
+    return best;
+}
+
+vector<TwoCarrierFit> fitTwoCarrierModelsConcurrently(const vector<MagnetoTransportSet> &sets) {
+    vector<TwoCarrierFit> fits(sets.size());
+    parallelFor(sets.size(), [&](size_t i) {
+        fits[i] = fitTwoCarrierModel(sets[i]);
+    });
+    return fits;
+}
+
+void fitTwoCarrierFile() {
+    string filename;
+    cout << "Magnetotransport file: ";
+    clearInputBuffer();
+    getline(cin, filename);
+    
+    vector<MagnetoTransportSet> sets;
+    if (!loadMagnetoTransportSets(filename, sets)) return;
+    if (sets.empty()) {
+        cout << "\nNo field points found in '" << filename << "'.\n";
+        return;
+    }
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<TwoCarrierFit> fits = fitTwoCarrierModelsConcurrently(sets);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    const size_t max_rows = 20;
+    cout << "\n------ TWO-CARRIER FITS ------\n";
+    cout << "Sample\tT (K)\tn (cm⁻³)\tμn (cm²/V·s)\tp (cm⁻³)\tμp (cm²/V·s)\tResidual\tClassification\n";
+    cout << "------------------------------------------------------------------------------------------------------------\n";
+    for (size_t i = 0; i < fits.size() && i < max_rows; i++) {
+        const TwoCarrierFit &f = fits[i];
+        cout << f.sample_id << "\t" << fixed << setprecision(1) << f.T_K << "\t" << scientific << setprecision(3)
+             << f.electron_density << "\t" << f.electron_mobility << "\t" << f.hole_density << "\t"
+             << f.hole_mobility << "\t" << f.residual << "\t"
+             << classifyCarriers(f.electron_density, f.electron_mobility, f.hole_density, f.hole_mobility)
+             << (f.converged ? "" : " (not converged)") << "\n";
+    }
+    if (fits.size() > max_rows) cout << "... " << fits.size() - max_rows << " more\n";
+    
+    cout << fixed << setprecision(0);
+    cout << "\nFitted " << fits.size() << " sets in " << seconds * 1e3 << " ms ("
+         << fits.size() / max(seconds, 1e-9) << " fits/s)\n";
+}
+
+// Built-in classifier, in the same format loadMaterialClassifier() reads:
+//   tree [<nodes>]                         starts a tree (several make a voting forest);
+//                                          node ids must then be below <nodes>
+//   node <id> <feature> <threshold> <left> <right>   x[feature] < threshold goes left
+//   leaf <id> <class>
+//   end
+// Features are the CarrierFeature order and classes the MaterialClass order.
+const char *const default_material_tree =
+    "# sigma < 1e-8 S/cm: insulator; n >= 1e22: metal; n >= 1e19: heavily doped\n"
+    "tree\n"
+    "node 0 0 -8 1 2\n"
+    "leaf 1 3\n"
+    "node 2 1 22 3 4\n"
+    "node 3 1 19 5 6\n"
+    "leaf 4 0\n"
+    "node 5 2 0 7 8\n"
+    "leaf 6 4\n"
+    "leaf 7 1\n"
+    "leaf 8 2\n"
+    "end\n";
+
+bool parseForest(istream &in, vector<DecisionTree> &forest, string &error) {
+    forest.clear();
+    string line;
+    int line_number = 0;
+    bool in_tree = false;
+    int node_limit = 0;  // ids of the current tree must be below this
+    while (getline(in, line)) {
+        line_number++;
+        istringstream words(line);
+        string keyword;
+        if (!(words >> keyword) || keyword[0] == '#') continue;
+        
+        ostringstream where;
+        where << "line " << line_number << ": ";
+        if (keyword == "tree") {
+            int declared_nodes;
+            node_limit = words >> declared_nodes ? declared_nodes : max_tree_nodes;
+            if (node_limit < 1 || node_limit > max_tree_nodes) {
+                error = where.str() + "a tree has 1 to " + to_string(max_tree_nodes) + " nodes";
+                return false;
+            }
+            if (forest.size() == max_forest_trees) {
+                error = where.str() + "a forest has at most " + to_string(max_forest_trees) + " trees";
+                return false;
+            }
+            forest.push_back(DecisionTree());
+            in_tree = true;
+        } else if (keyword == "end") {
+            in_tree = false;
+        } else if ((keyword == "node" || keyword == "leaf") && in_tree) {
+            TreeNode node = {keyword == "leaf", 0, 0, -1, -1, 0};
+            int id;
+            bool ok = keyword == "leaf" ? static_cast<bool>(words >> id >> node.label)
+                                        : static_cast<bool>(words >> id >> node.feature >> node.threshold >> node.left >> node.right);
+            if (!ok || id < 0 || id >= node_limit || node.label < 0 || node.label >= NUM_MATERIAL_CLASSES ||
+                node.feature < 0 || node.feature >= NUM_CARRIER_FEATURES) {
+                error = where.str() + "malformed " + keyword;
+                return false;
+            }
+            vector<TreeNode> &nodes = forest.back().nodes;
+            if (static_cast<size_t>(id) >= nodes.size()) nodes.resize(id + 1, TreeNode());
+            nodes[id] = node;
+        } else {
+            error = where.str() + "unexpected '" + keyword + "'";
+            return false;
+        }
+    }
+    if (forest.empty()) {
+        error = "no trees found";
+        return false;
+    }
+    
+    // Every child must exist, and the depth must fit the compiled layout
+    for (size_t t = 0; t < forest.size(); t++) {
+        vector<pair<int, int>> stack(1, make_pair(0, 0));
+        size_t visited = 0;
+        while (!stack.empty()) {
+            int id = stack.back().first, depth = stack.back().second;
+            stack.pop_back();
+            if (id < 0 || static_cast<size_t>(id) >= forest[t].nodes.size() || ++visited > forest[t].nodes.size()) {
+                error = "tree " + to_string(t + 1) + " has a missing node or a cycle";
+                return false;
+            }
+            const TreeNode &node = forest[t].nodes[id];
+            if (node.leaf) continue;
+            if (depth + 1 > max_tree_depth) {
+                error = "tree " + to_string(t + 1) + " is deeper than " + to_string(max_tree_depth);
+                return false;
+            }
+            stack.push_back(make_pair(node.left, depth + 1));
+            stack.push_back(make_pair(node.right, depth + 1));
+        }
+    }
+    return true;
+}
+
+static int treeDepth(const DecisionTree &tree, int id) {
+    const TreeNode &node = tree.nodes[id];
+    return node.leaf ? 0 : 1 + max(treeDepth(tree, node.left), treeDepth(tree, node.right));
+}
+
+// Copies node `id` into complete-tree slot `slot`; leaves above full depth become
+// always-left nodes (threshold +inf) whose subtree repeats the leaf
+static void flattenTree(const DecisionTree &tree, int id, size_t slot, int level, int depth,
+                        int *feature, double *threshold, unsigned char *leaf_class) {
+    const TreeNode &node = tree.nodes[id];
+    size_t internal = (size_t(1) << depth) - 1;
+    if (level == depth) {
+        leaf_class[slot - internal] = static_cast<unsigned char>(node.label);
+        return;
+    }
+    if (node.leaf) {
+        feature[slot] = 0;
+        threshold[slot] = numeric_limits<double>::infinity();
+        flattenTree(tree, id, 2 * slot + 1, level + 1, depth, feature, threshold, leaf_class);
+        flattenTree(tree, id, 2 * slot + 2, level + 1, depth, feature, threshold, leaf_class);
+    } else {
+        feature[slot] = node.feature;
+        threshold[slot] = node.threshold;
+        flattenTree(tree, node.left, 2 * slot + 1, level + 1, depth, feature, threshold, leaf_class);
+        flattenTree(tree, node.right, 2 * slot + 2, level + 1, depth, feature, threshold, leaf_class);
+    }
+}
+
+CompiledForest compileForest(const vector<DecisionTree> &forest) {
+    CompiledForest compiled;
+    compiled.depth = 0;
+    compiled.num_trees = forest.size();
+    for (size_t t = 0; t < forest.size(); t++) compiled.depth = max(compiled.depth, treeDepth(forest[t], 0));
+    
+    size_t internal = (size_t(1) << compiled.depth) - 1, leaves = size_t(1) << compiled.depth;
+    compiled.feature.assign(forest.size() * internal, 0);
+    compiled.threshold.assign(forest.size() * internal, 0);
+    compiled.leaf_class.assign(forest.size() * leaves, 0);
+    for (size_t t = 0; t < forest.size(); t++) {
+        // data(): a forest of single leaves has depth 0 and no internal nodes at all
+        flattenTree(forest[t], 0, 0, 0, compiled.depth, compiled.feature.data() + t * internal,
+                    compiled.threshold.data() + t * internal, compiled.leaf_class.data() + t * leaves);
+    }
+    return compiled;
+}
+
+// Classifies n row-major feature vectors. Samples are processed in blocks: each level of
+// each tree advances every sample in the block with the same index arithmetic, a loop
+// the compiler can vectorise (gathers on AVX2) since it has no data-dependent branches.
+// With several trees the class with most votes wins, ties going to the lower class.
+void classifyBatch(const CompiledForest &forest, const double *features, size_t n, unsigned char *classes) {
+    const size_t block = 256;
+    size_t internal = (size_t(1) << forest.depth) - 1, leaves = size_t(1) << forest.depth;
+    size_t index[block];
+    unsigned short votes[block][NUM_MATERIAL_CLASSES];
+    
+    for (size_t start = 0; start < n; start += block) {
+        size_t count = min(block, n - start);
+        const double *x = features + start * NUM_CARRIER_FEATURES;
+        memset(votes, 0, sizeof(votes));
+        
+        for (size_t t = 0; t < forest.num_trees; t++) {
+            const int *feature = forest.feature.data() + t * internal;
+            const double *threshold = forest.threshold.data() + t * internal;
+            const unsigned char *leaf_class = forest.leaf_class.data() + t * leaves;
+            
+            for (size_t s = 0; s < count; s++) index[s] = 0;
+            for (int level = 0; level < forest.depth; level++) {
+                for (size_t s = 0; s < count; s++) {
+                    size_t i = index[s];
+                    index[s] = 2 * i + 1 + (x[s * NUM_CARRIER_FEATURES + feature[i]] >= threshold[i]);
+                }
+            }
+            for (size_t s = 0; s < count; s++) votes[s][leaf_class[index[s] - internal]]++;
+        }
+        
+        for (size_t s = 0; s < count; s++) {
+            int best = 0;
+            for (int c = 1; c < NUM_MATERIAL_CLASSES; c++) {
+                if (votes[s][c] > votes[s][best]) best = c;
+            }
+            classes[start + s] = static_cast<unsigned char>(best);
+        }
+    }
+}
+
+// Reference evaluation that walks the parsed trees one sample at a time
+int classifyWithTree(const vector<DecisionTree> &forest, const double *x) {
+    int votes[NUM_MATERIAL_CLASSES] = {0};
+    for (size_t t = 0; t < forest.size(); t++) {
+        const TreeNode *node = &forest[t].nodes[0];
+        while (!node->leaf) {
+            node = &forest[t].nodes[x[node->feature] < node->threshold ? node->left : node->right];
+        }
+        votes[node->label]++;
+    }
+    int best = 0;
+    for (int c = 1; c < NUM_MATERIAL_CLASSES; c++) {
+        if (votes[c] > votes[best]) best = c;
+    }
+    return best;
+}
+
+// Classifier used by classifyCarriers(); starts as the built-in tree
+CompiledForest &activeMaterialForest() {
+    static CompiledForest forest = []() {
+        vector<DecisionTree> trees;
+        string error;
+        istringstream in(default_material_tree);
+        parseForest(in, trees, error);
+        return compileForest(trees);
+    }();
+    return forest;
+}
+
+void loadMaterialClassifier() {
+    string filename;
+    cout << "Classifier tree file (blank for built-in): ";
+    clearInputBuffer();
+    getline(cin, filename);
+    
+    vector<DecisionTree> forest;
+    string error;
+    if (filename.empty()) {
+        istringstream in(default_material_tree);
+        parseForest(in, forest, error);
+    } else {
+        ifstream file(filename.c_str());
+        if (!file.is_open()) {
+            cout << "\nError: Could not open '" << filename << "'.\n";
+            return;
+        }
+        if (!parseForest(file, forest, error)) {
+            cout << "\nError in '" << filename << "': " << error << "\n";
+            return;
+        }
+    }
+    
+    activeMaterialForest() = compileForest(forest);
+    cout << "\nLoaded " << forest.size() << " tree(s), compiled to depth " << activeMaterialForest().depth << ".\n";
+}
+
+// Times the compiled batch classifier against walking the trees one sample at a time
+void benchmarkMaterialClassifier() {
+    const size_t n = 1000000;
+    mt19937 rng(2024);
+    uniform_real_distribution<double> log_sigma(-14.0, 6.0), log_density(8.0, 23.5), log_mobility(-1.0, 5.0);
+    
+    vector<double> features(n * NUM_CARRIER_FEATURES);
+    for (size_t i = 0; i < n; i++) {
+        double *x = &features[i * NUM_CARRIER_FEATURES];
+        x[FEATURE_LOG_CONDUCTIVITY] = log_sigma(rng);
+        x[FEATURE_LOG_MAJORITY_DENSITY] = log_density(rng);
+        x[FEATURE_MAJORITY_SIGN] = rng() % 2 ? 1.0 : -1.0;
+        x[FEATURE_LOG_MAJORITY_MOBILITY] = log_mobility(rng);
+    }
+    
+    vector<DecisionTree> trees;
+    string error;
+    istringstream in(default_material_tree);
+    parseForest(in, trees, error);
+    CompiledForest compiled = compileForest(trees);
+    
+    vector<unsigned char> batch(n), reference(n);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    classifyBatch(compiled, &features[0], n, &batch[0]);
+    double batch_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) reference[i] = static_cast<unsigned char>(classifyWithTree(trees, &features[i * NUM_CARRIER_FEATURES]));
+    double walk_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    size_t counts[NUM_MATERIAL_CLASSES] = {0}, mismatches = 0;
+    for (size_t i = 0; i < n; i++) {
+        counts[batch[i]]++;
+        mismatches += batch[i] != reference[i];
+    }
+    
+    cout << fixed << setprecision(1);
+    cout << "\n------ CLASSIFIER BENCHMARK (" << n << " samples, built-in tree) ------\n";
+    cout << "Compiled batch:  " << batch_seconds * 1e3 << " ms (" << n / max(batch_seconds, 1e-9) / 1e6 << " M samples/s)\n";
+    cout << "Tree walk:       " << walk_seconds * 1e3 << " ms (" << n / max(walk_seconds, 1e-9) / 1e6 << " M samples/s)\n";
+    cout << "Disagreements:   " << mismatches << "\n";
+    for (int c = 0; c < NUM_MATERIAL_CLASSES; c++) {
+        cout << "  " << material_class_names[c] << ": " << counts[c] << "\n";
+    }
+}
+
+// Features of an analysed sweep; the loss peak needs a loss-tangent sweep and stays NaN
+DielectricFeatures extractDielectricFeatures(const RunResult &result) {
+    DielectricFeatures features;
+    bool fitted = result.prediction.peak_passed;
+    features.values[FEATURE_PEAK_EPSILON] = result.peak_epsilon;
+    features.values[FEATURE_CURIE_TEMP] = fitted ? result.prediction.predicted_curie_C : result.peak_temp;
+    features.values[FEATURE_CURIE_CONSTANT] = fitted ? result.prediction.curie_constant : numeric_limits<double>::quiet_NaN();
+    features.values[FEATURE_LOSS_PEAK] = numeric_limits<double>::quiet_NaN();
+    return features;
+}
+
+// One sample per line: <name> <peak ε> <Curie T °C> <Curie constant K> <loss peak>.
+// "nan" or "-" marks a feature that was not measured.
+bool loadDielectricFeatureFile(const string &filename, vector<string> &names, vector<DielectricFeatures> &features) {
+    ifstream file(filename.c_str());
+    if (!file.is_open()) {
+        cout << "\nError: Could not open '" << filename << "'.\n";
+        return false;
+    }
+    
+    string line;
+    int rejected = 0;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream in(line);
+        string name, field;
+        DielectricFeatures f;
+        bool ok = static_cast<bool>(in >> name);
+        for (int d = 0; d < NUM_DIELECTRIC_FEATURES && ok; d++) {
+            ok = static_cast<bool>(in >> field);
+            if (!ok) break;
+            if (field == "-" || field == "nan") {
+                f.values[d] = numeric_limits<double>::quiet_NaN();
+            } else {
+                char *end;
+                f.values[d] = strtod(field.c_str(), &end);
+                ok = *end == '\0';
+            }
+        }
+        if (!ok) {
+            rejected++;
+            continue;
+        }
+        names.push_back(name);
+        features.push_back(f);
+    }
+    
+    if (rejected > 0) cout << rejected << " invalid line(s) skipped.\n";
+    return true;
+}
+
+DielectricLibrary buildDielectricLibrary(const vector<string> &names, const vector<DielectricFeatures> &features) {
+    DielectricLibrary library;
+    library.names = names;
+    for (int d = 0; d < NUM_DIELECTRIC_FEATURES; d++) {
+        double sum = 0, sum_sq = 0;
+        size_t count = 0;
+        for (size_t i = 0; i < features.size(); i++) {
+            double v = features[i].values[d];
+            if (v != v) continue;
+            sum += v;
+            sum_sq += v * v;
+            count++;
+        }
+        double mean = count ? sum / count : 0;
+        double variance = count ? sum_sq / count - mean * mean : 0;
+        library.scale[d] = variance > 0 ? sqrt(variance) : 1.0;
+        
+        library.columns[d].resize(features.size());
+        for (size_t i = 0; i < features.size(); i++) library.columns[d][i] = features[i].values[d] / library.scale[d];
+    }
+    return library;
+}
+
+// Adds squared scaled differences between a query and rows [begin, end) of a set of
+// feature columns into sum[], counting in used[] the features both sides measured (NaN
+// means unmeasured). One pass per column of plain array arithmetic, which vectorises.
+void accumulateColumnDistances(const double *query, const double *scale, const vector<double> *columns, int num_features,
+                               size_t begin, size_t end, double *sum, double *used) {
+    for (int d = 0; d < num_features; d++) {
+        double value = query[d] / scale[d];
+        if (value != value) continue; // query did not measure this feature
+        const double *column = &columns[d][0];
+        for (size_t i = begin; i < end; i++) {
+            double diff = value - column[i];
+            bool present = diff == diff;
+            sum[i] += present ? diff * diff : 0.0;
+            used[i] += present ? 1.0 : 0.0;
+        }
+    }
+}
+
+// Brute-force k nearest references for every query. Distances are rescaled to all
+// features so partially measured samples compare fairly, and the k best are kept in a
+// small max-heap. Queries are spread over the worker pool.
+vector<vector<Neighbour>> knnSearchBatch(const DielectricLibrary &library, const vector<DielectricFeatures> &queries, size_t k) {
+    size_t n = library.names.size();
+    k = min(k, n);
+    vector<vector<Neighbour>> results(queries.size());
+    vector<vector<double>> sums(workerCount(queries.size()), vector<double>(n));
+    vector<vector<double>> used(workerCount(queries.size()), vector<double>(n));
+    
+    parallelForWorkers(queries.size(), [&](unsigned worker, size_t q) {
+        double *sum = &sums[worker][0];
+        double *dims = &used[worker][0];
+        fill(sum, sum + n, 0.0);
+        fill(dims, dims + n, 0.0);
+        
+        accumulateColumnDistances(queries[q].values, library.scale, library.columns, NUM_DIELECTRIC_FEATURES, 0, n, sum, dims);
+        
+        vector<pair<double, size_t>> heap; // max-heap on distance
+        heap.reserve(k + 1);
+        for (size_t i = 0; i < n; i++) {
+            if (dims[i] == 0) continue;
+            double distance = sum[i] * NUM_DIELECTRIC_FEATURES / dims[i];
+            if (heap.size() < k) {
+                heap.push_back(make_pair(distance, i));
+                push_heap(heap.begin(), heap.end());
+            } else if (distance < heap.front().first) {
+                pop_heap(heap.begin(), heap.end());
+                heap.back() = make_pair(distance, i);
+                push_heap(heap.begin(), heap.end());
+            }
+        }
+        sort_heap(heap.begin(), heap.end());
+        
+        for (size_t j = 0; j < heap.size(); j++) {
+            Neighbour neighbour = {heap[j].second, sqrt(heap[j].first)};
+            results[q].push_back(neighbour);
+        }
+    });
+    return results;
+}
+
+void identifyDielectricsKnn() {
+    string reference_file, query_file;
+    int k, source;
+    cout << "Reference library file: ";
+    clearInputBuffer();
+    getline(cin, reference_file);
+    cout << "Unknown samples from:\n1. A feature file\n2. A plate run file (features from each channel's sweep)\nSelect (1-2): ";
+    while (!(cin >> source) || source < 1 || source > 2) {
+        cout << "Invalid selection. Please enter 1 or 2: ";
+        clearInputBuffer();
+    }
+    cout << (source == 1 ? "Unknown samples file: " : "Plate run file: ");
+    clearInputBuffer();
+    getline(cin, query_file);
+    cout << "Number of neighbours (k): ";
+    while (!(cin >> k) || k < 1) {
+        cout << "Invalid input. Please enter a positive number: ";
+        clearInputBuffer();
+    }
+    
+    vector<string> reference_names, query_names;
+    vector<DielectricFeatures> reference_features, query_features;
+    if (!loadDielectricFeatureFile(reference_file, reference_names, reference_features)) return;
+    if (source == 1) {
+        if (!loadDielectricFeatureFile(query_file, query_names, query_features)) return;
+    } else {
+        MultiplexedRun run;
+        if (!loadMultiplexedRun(query_file, run)) return;
+        map<int, Sample> demuxed = demultiplexRun(run);
+        vector<Sample> samples;
+        for (map<int, Sample>::iterator it = demuxed.begin(); it != demuxed.end(); ++it) {
+            query_names.push_back("channel " + to_string(it->first));
+            samples.push_back(it->second);
+        }
+        vector<RunResult> results = analyzeSamplesConcurrently(samples);
+        for (size_t i = 0; i < results.size(); i++) query_features.push_back(extractDielectricFeatures(results[i]));
+    }
+    if (reference_names.empty() || query_names.empty()) {
+        cout << "\nBoth files need at least one sample.\n";
+        return;
+    }
+    
+    DielectricLibrary library = buildDielectricLibrary(reference_names, reference_features);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<vector<Neighbour>> neighbours = knnSearchBatch(library, query_features, k);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    const size_t max_rows = 20;
+    cout << "\n------ NEAREST REFERENCE MATERIALS (k = " << k << ") ------\n";
+    for (size_t q = 0; q < neighbours.size() && q < max_rows; q++) {
+        // Majority vote among the neighbours, closest first on ties
+        map<string, int> votes;
+        string best;
+        for (size_t j = 0; j < neighbours[q].size(); j++) {
+            const string &name = library.names[neighbours[q][j].index];
+            if (++votes[name] > votes[best] || best.empty()) best = name;
+        }
+        cout << query_names[q] << ": " << (best.empty() ? "no comparable reference" : best) << "\n";
+        for (size_t j = 0; j < neighbours[q].size(); j++) {
+            cout << fixed << setprecision(3) << "    " << library.names[neighbours[q][j].index]
+                 << " (distance " << neighbours[q][j].distance << ")\n";
+        }
+    }
+    if (neighbours.size() > max_rows) cout << "... " << neighbours.size() - max_rows << " more\n";
+    
+    cout << fixed << setprecision(0);
+    cout << "\nSearched " << neighbours.size() << " queries against " << library.names.size() << " references in "
+         << seconds * 1e3 << " ms (" << neighbours.size() / max(seconds, 1e-9) << " queries/s)\n";
+}
+
+// Record file, one measurement per line, linked by sample id:
+//   dielectric <id> <peak ε> <Curie T °C> <Curie constant K> <loss peak>
+//   hall <id> <n cm⁻³> <μn cm²/V·s> <p cm⁻³> <μp cm²/V·s>
+//   material <id> <material name>        labels a reference record
+// "nan" or "-" marks an unmeasured dielectric feature.
+bool loadSampleRecords(const string &filename, vector<SampleRecord> &records) {
+    ifstream file(filename.c_str());
+    if (!file.is_open()) {
+        cout << "\nError: Could not open '" << filename << "'.\n";
+        return false;
+    }
+    
+    map<string, size_t> index;
+    string line;
+    int rejected = 0;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream in(line);
+        string kind, id, material;
+        if (!(in >> kind >> id) || (kind != "dielectric" && kind != "hall" && kind != "material") ||
+            (kind == "material" && !getline(in >> ws, material))) {
+            rejected++;
+            continue;
+        }
+        
+        double values[NUM_DIELECTRIC_FEATURES];
+        bool ok = true;
+        for (int d = 0; d < NUM_DIELECTRIC_FEATURES && ok && kind != "material"; d++) {
+            string field;
+            ok = static_cast<bool>(in >> field);
+            if (!ok) break;
+            if (kind == "dielectric" && (field == "-" || field == "nan")) {
+                values[d] = numeric_limits<double>::quiet_NaN();
+            } else {
+                char *end;
+                values[d] = strtod(field.c_str(), &end);
+                ok = *end == '\0' && (kind == "dielectric" || values[d] >= 0);
+            }
+        }
+        if (!ok) {
+            rejected++;
+            continue;
+        }
+        
+        if (!index.count(id)) {
+            index[id] = records.size();
+            SampleRecord record;
+            record.sample_id = id;
+            record.has_dielectric = record.has_hall = false;
+            for (int d = 0; d < NUM_FUSED_FEATURES; d++) record.features[d] = numeric_limits<double>::quiet_NaN();
+            records.push_back(record);
+        }
+        SampleRecord &record = records[index[id]];
+        if (kind == "material") {
+            record.material = material;
+        } else if (kind == "dielectric") {
+            record.has_dielectric = true;
+            for (int d = 0; d < NUM_DIELECTRIC_FEATURES; d++) record.features[d] = values[d];
+        } else {
+            record.has_hall = true;
+            carrierFeatures(values[0], values[1], values[2], values[3], record.features + NUM_DIELECTRIC_FEATURES);
+        }
+    }
+    
+    if (rejected > 0) cout << rejected << " invalid line(s) skipped.\n";
+    return true;
+}
+
+static int hallBucket(const SampleRecord &record) {
+    if (!record.has_hall) return no_hall_bucket;
+    unsigned char label;
+    classifyBatch(activeMaterialForest(), record.features + NUM_DIELECTRIC_FEATURES, 1, &label);
+    return label;
+}
+
+FusedReferenceIndex buildFusedReferenceIndex(const vector<SampleRecord> &references) {
+    FusedReferenceIndex index;
+    
+    // Counting sort of the references into their Hall-class buckets
+    vector<int> bucket(references.size());
+    size_t counts[NUM_MATERIAL_CLASSES + 1] = {0};
+    for (size_t i = 0; i < references.size(); i++) {
+        bucket[i] = hallBucket(references[i]);
+        counts[bucket[i]]++;
+    }
+    index.bucket_start[0] = 0;
+    for (int b = 0; b <= NUM_MATERIAL_CLASSES; b++) index.bucket_start[b + 1] = index.bucket_start[b] + counts[b];
+    vector<size_t> order(references.size());
+    size_t fill_position[NUM_MATERIAL_CLASSES + 1];
+    for (int b = 0; b <= NUM_MATERIAL_CLASSES; b++) fill_position[b] = index.bucket_start[b];
+    for (size_t i = 0; i < references.size(); i++) order[fill_position[bucket[i]]++] = i;
+    
+    for (int d = 0; d < NUM_FUSED_FEATURES; d++) {
+        double sum = 0, sum_sq = 0;
+        size_t count = 0;
+        for (size_t i = 0; i < references.size(); i++) {
+            double v = references[i].features[d];
+            if (v != v) continue;
+            sum += v;
+            sum_sq += v * v;
+            count++;
+        }
+        double mean = count ? sum / count : 0;
+        double variance = count ? sum_sq / count - mean * mean : 0;
+        index.scale[d] = variance > 0 ? sqrt(variance) : 1.0;
+        index.columns[d].resize(references.size());
+    }
+    
+    index.names.resize(references.size());
+    for (size_t row = 0; row < order.size(); row++) {
+        const SampleRecord &record = references[order[row]];
+        index.names[row] = record.material.empty() ? record.sample_id : record.material;
+        for (int d = 0; d < NUM_FUSED_FEATURES; d++) index.columns[d][row] = record.features[d] / index.scale[d];
+    }
+    return index;
+}
+
+// Scores every sample against the references on the fused feature vector. A sample with
+// Hall data first scans only references of the same carrier class plus those without
+// Hall data, which prunes most of a large reference set; if nothing there is closer than
+// fused_rescan_distance (a sample near a class boundary) the other buckets are scanned
+// too. A sample without Hall data scans everything. Reference names may repeat, and each
+// distinct name is scored by its closest record.
+vector<FusedMatch> identifyFusedBatch(const FusedReferenceIndex &index, const vector<SampleRecord> &samples) {
+    size_t n = index.names.size();
+    vector<FusedMatch> matches(samples.size());
+    vector<vector<double>> sums(workerCount(samples.size()), vector<double>(n));
+    vector<vector<double>> used(workerCount(samples.size()), vector<double>(n));
+    
+    parallelForWorkers(samples.size(), [&](unsigned worker, size_t q) {
+        double *sum = &sums[worker][0];
+        double *dims = &used[worker][0];
+        FusedMatch &match = matches[q];
+        match.hall_class = hallBucket(samples[q]);
+        match.best_distance = match.runner_up_distance = numeric_limits<double>::infinity();
+        
+        // Buckets in scan order: own class and no-Hall first, the rest only on a rescan
+        vector<int> buckets;
+        if (match.hall_class != no_hall_bucket) buckets.push_back(match.hall_class);
+        buckets.push_back(no_hall_bucket);
+        size_t first_pass = match.hall_class == no_hall_bucket ? 0 : buckets.size();
+        for (int b = 0; b < NUM_MATERIAL_CLASSES; b++) {
+            if (b != match.hall_class) buckets.push_back(b);
+        }
+        
+        for (size_t k = 0; k < buckets.size(); k++) {
+            if (k == first_pass && first_pass > 0 && match.best_distance <= fused_rescan_distance) break;
+            size_t begin = index.bucket_start[buckets[k]], end = index.bucket_start[buckets[k] + 1];
+            fill(sum + begin, sum + end, 0.0);
+            fill(dims + begin, dims + end, 0.0);
+            accumulateColumnDistances(samples[q].features, index.scale, index.columns, NUM_FUSED_FEATURES, begin, end, sum, dims);
+            
+            for (size_t i = begin; i < end; i++) {
+                if (dims[i] == 0) continue;
+                double distance = sqrt(sum[i] * NUM_FUSED_FEATURES / dims[i]);
+                const string &name = index.names[i];
+                if (distance < match.best_distance) {
+                    if (name != match.best) {
+                        match.runner_up = match.best;
+                        match.runner_up_distance = match.best_distance;
+                    }
+                    match.best = name;
+                    match.best_distance = distance;
+                } else if (distance < match.runner_up_distance && name != match.best) {
+                    match.runner_up = name;
+                    match.runner_up_distance = distance;
+                }
+            }
+        }
+    });
+    return matches;
+}
+
+void identifyFusedRecords() {
+    string reference_file, sample_file;
+    cout << "Reference records file: ";
+    clearInputBuffer();
+    getline(cin, reference_file);
+    cout << "Unknown sample records file: ";
+    getline(cin, sample_file);
+    
+    vector<SampleRecord> references, samples;
+    if (!loadSampleRecords(reference_file, references)) return;
+    if (!loadSampleRecords(sample_file, samples)) return;
+    if (references.empty() || samples.empty()) {
+        cout << "\nBoth files need at least one record.\n";
+        return;
+    }
+    
+    FusedReferenceIndex index = buildFusedReferenceIndex(references);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<FusedMatch> matches = identifyFusedBatch(index, samples);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    const size_t max_rows = 20;
+    cout << "\n------ FUSED IDENTIFICATION ------\n";
+    cout << "Sample\t\tData\t\tCarrier class\t\t\tBest match (distance)\t\tRunner-up (distance)\n";
+    for (size_t q = 0; q < matches.size() && q < max_rows; q++) {
+        const FusedMatch &m = matches[q];
+        const SampleRecord &r = samples[q];
+        cout << r.sample_id << "\t\t" << (r.has_dielectric && r.has_hall ? "ε + Hall" : (r.has_hall ? "Hall" : "ε")) << "\t\t"
+             << (m.hall_class == no_hall_bucket ? "-" : material_class_names[m.hall_class]) << "\t\t";
+        cout << fixed << setprecision(3);
+        if (m.best.empty()) cout << "no comparable reference";
+        else cout << m.best << " (" << m.best_distance << ")";
+        if (!m.runner_up.empty()) cout << "\t\t" << m.runner_up << " (" << m.runner_up_distance << ")";
+        cout << "\n";
+    }
+    if (matches.size() > max_rows) cout << "... " << matches.size() - max_rows << " more\n";
+    
+    cout << fixed << setprecision(0);
+    cout << "\nIdentified " << matches.size() << " samples against " << index.names.size() << " references in "
+         << seconds * 1e3 << " ms (" << matches.size() / max(seconds, 1e-9) << " samples/s)\n";
+}
+
+// log10 ranges per class for the synthetic sets: majority density (cm⁻³), majority mobility (cm²/V·s)
+static const double synthetic_density_range[NUM_MATERIAL_CLASSES][2] = {{22.0, 23.3}, {12.0, 19.0}, {12.0, 19.0}, {0.0, 9.0}, {19.0, 21.5}};
+static const double synthetic_mobility_range[NUM_MATERIAL_CLASSES][2] = {{0.0, 2.0}, {2.0, 4.5}, {1.5, 3.5}, {-1.0, 1.0}, {0.3, 2.5}};
+
+// Draws physically plausible carrier populations for every class, with 0.1-decade
+// measurement scatter, so samples near class boundaries can be misclassified. Chunks are
+// generated in parallel, each from its own seed, so the set is the same on any machine.
+LabelledCarrierSet generateLabelledCarrierSet(size_t n, unsigned seed) {
+    const size_t chunk = 65536;
+    
+    LabelledCarrierSet set;
+    set.features.resize(n * NUM_CARRIER_FEATURES);
+    set.labels.resize(n);
+    
+    parallelFor((n + chunk - 1) / chunk, [&](size_t c) {
+        mt19937 rng(seed + static_cast<unsigned>(c));
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        normal_distribution<double> scatter(0.0, 0.1);
+        for (size_t i = c * chunk; i < min(n, (c + 1) * chunk); i++) {
+            int label = static_cast<int>(rng() % NUM_MATERIAL_CLASSES);
+            double log_density = synthetic_density_range[label][0] + (synthetic_density_range[label][1] - synthetic_density_range[label][0]) * unit(rng);
+            double log_mobility = synthetic_mobility_range[label][0] + (synthetic_mobility_range[label][1] - synthetic_mobility_range[label][0]) * unit(rng);
+            bool holes = label == CLASS_P_TYPE || (label != CLASS_N_TYPE && unit(rng) < 0.3);
+            
+            // Minority carriers a thousand times rarer, then measurement scatter
+            double majority_n = pow(10.0, log_density + scatter(rng)), majority_mu = pow(10.0, log_mobility + scatter(rng));
+            double minority_n = majority_n * 1e-3, minority_mu = majority_mu * 0.5;
+            if (holes) carrierFeatures(minority_n, minority_mu, majority_n, majority_mu, &set.features[i * NUM_CARRIER_FEATURES]);
+            else carrierFeatures(majority_n, majority_mu, minority_n, minority_mu, &set.features[i * NUM_CARRIER_FEATURES]);
+            set.labels[i] = static_cast<unsigned char>(label);
+        }
+    });
+    return set;
+}
+
+// One sample per line: <class index> <n cm⁻³> <μn cm²/V·s> <p cm⁻³> <μp cm²/V·s>,
+// with classes in MaterialClass order
+bool loadLabelledCarrierSet(const string &filename, LabelledCarrierSet &set) {
+    ifstream file(filename.c_str());
+    if (!file.is_open()) {
+        cout << "\nError: Could not open '" << filename << "'.\n";
+        return false;
+    }
+    
+    string line;
+    int rejected = 0;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream in(line);
+        int label;
+        double n, mu_n, p, mu_p;
+        if (!(in >> label >> n >> mu_n >> p >> mu_p) || label < 0 || label >= NUM_MATERIAL_CLASSES ||
+            n < 0 || mu_n < 0 || p < 0 || mu_p < 0) {
+            rejected++;
+            continue;
+        }
+        set.features.resize(set.features.size() + NUM_CARRIER_FEATURES);
+        carrierFeatures(n, mu_n, p, mu_p, &set.features[set.features.size() - NUM_CARRIER_FEATURES]);
+        set.labels.push_back(static_cast<unsigned char>(label));
+    }
+    
+    if (rejected > 0) cout << rejected << " invalid line(s) skipped.\n";
+    return true;
+}
+
+// Synthetic materials for judging the fused identifier: each has its own dielectric
+// signature and carrier population, and every record of it is a fresh measurement with
+// 2% dielectric and 0.1-decade carrier scatter. One record in five lacks Hall data and
+// one in ten lacks the dielectric sweep, as in a real mix of instruments.
+vector<SampleRecord> generateLabelledFusedRecords(size_t num_materials, size_t per_material, unsigned seed) {
+    struct Signature {
+        double dielectric[NUM_DIELECTRIC_FEATURES];
+        double log_density, log_mobility;
+        bool holes;
+    };
+    
+    mt19937 rng(seed);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    vector<Signature> signatures(num_materials);
+    for (size_t m = 0; m < num_materials; m++) {
+        Signature &sig = signatures[m];
+        int label = static_cast<int>(rng() % NUM_MATERIAL_CLASSES);
+        sig.dielectric[FEATURE_PEAK_EPSILON] = pow(10.0, 1.0 + 3.0 * unit(rng));
+        sig.dielectric[FEATURE_CURIE_TEMP] = -200.0 + 800.0 * unit(rng);
+        sig.dielectric[FEATURE_CURIE_CONSTANT] = pow(10.0, 4.0 + 1.3 * unit(rng));
+        sig.dielectric[FEATURE_LOSS_PEAK] = pow(10.0, -3.0 + 2.0 * unit(rng));
+        sig.log_density = synthetic_density_range[label][0] + (synthetic_density_range[label][1] - synthetic_density_range[label][0]) * unit(rng);
+        sig.log_mobility = synthetic_mobility_range[label][0] + (synthetic_mobility_range[label][1] - synthetic_mobility_range[label][0]) * unit(rng);
+        sig.holes = label == CLASS_P_TYPE || (label != CLASS_N_TYPE && unit(rng) < 0.3);
+    }
+    
+    vector<SampleRecord> records(num_materials * per_material);
+    parallelFor(num_materials, [&](size_t m) {
+        mt19937 record_rng(seed + 1 + static_cast<unsigned>(m));
+        uniform_real_distribution<double> draw(0.0, 1.0);
+        normal_distribution<double> dielectric_scatter(0.0, 0.02), carrier_scatter(0.0, 0.1);
+        const Signature &sig = signatures[m];
+        for (size_t r = 0; r < per_material; r++) {
+            SampleRecord &record = records[m * per_material + r];
+            ostringstream id;
+            id << "S" << m << "-" << r;
+            record.sample_id = id.str();
+            ostringstream name;
+            name << "Synthetic-" << m;
+            record.material = name.str();
+            for (int d = 0; d < NUM_FUSED_FEATURES; d++) record.features[d] = numeric_limits<double>::quiet_NaN();
+            
+            double roll = draw(record_rng);
+            record.has_dielectric = roll >= 0.1;
+            record.has_hall = roll < 0.1 || roll >= 0.3;
+            if (record.has_dielectric) {
+                for (int d = 0; d < NUM_DIELECTRIC_FEATURES; d++) record.features[d] = sig.dielectric[d] * (1.0 + dielectric_scatter(record_rng));
+            }
+            if (record.has_hall) {
+                double majority_n = pow(10.0, sig.log_density + carrier_scatter(record_rng));
+                double majority_mu = pow(10.0, sig.log_mobility + carrier_scatter(record_rng));
+                double minority_n = majority_n * 1e-3, minority_mu = majority_mu * 0.5;
+                if (sig.holes) carrierFeatures(minority_n, minority_mu, majority_n, majority_mu, record.features + NUM_DIELECTRIC_FEATURES);
+                else carrierFeatures(majority_n, majority_mu, minority_n, minority_mu, record.features + NUM_DIELECTRIC_FEATURES);
+            }
+        }
+    });
+    return records;
+}
+
+// Scores labelled samples with the fused dielectric + Hall identifier and reports how
+// often the best match names the true material, split by which measurements the sample
+// had, and samples per second
+void evaluateFusedIdentifier(const vector<SampleRecord> &references, const vector<SampleRecord> &samples) {
+    FusedReferenceIndex index = buildFusedReferenceIndex(references);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<FusedMatch> matches = identifyFusedBatch(index, samples);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    // Rows: ε + Hall, Hall only, ε only
+    const char *data_names[3] = {"ε + Hall", "Hall only", "ε only"};
+    size_t totals[3] = {0}, correct[3] = {0}, runner_up[3] = {0}, labelled = 0;
+    for (size_t q = 0; q < samples.size(); q++) {
+        const SampleRecord &r = samples[q];
+        if (r.material.empty()) continue;
+        int row = r.has_dielectric && r.has_hall ? 0 : (r.has_hall ? 1 : 2);
+        totals[row]++;
+        labelled++;
+        if (matches[q].best == r.material) correct[row]++;
+        else if (matches[q].runner_up == r.material) runner_up[row]++;
+    }
+    if (labelled == 0) {
+        cout << "\nNo labelled samples to evaluate (add \"material <id> <name>\" lines).\n";
+        return;
+    }
+    
+    cout << "\n------ FUSED IDENTIFIER EVALUATION (" << labelled << " labelled samples, " << index.names.size()
+         << " references) ------\n";
+    cout << fixed << setprecision(4);
+    cout << setw(12) << "Data" << setw(10) << "Samples" << setw(12) << "Top-1" << setw(12) << "Top-2" << "\n";
+    size_t all_correct = 0, all_top2 = 0;
+    for (int row = 0; row < 3; row++) {
+        all_correct += correct[row];
+        all_top2 += correct[row] + runner_up[row];
+        cout << setw(12) << data_names[row] << setw(10) << totals[row] << setw(12);
+        if (totals[row]) cout << static_cast<double>(correct[row]) / totals[row] << setw(12)
+                              << static_cast<double>(correct[row] + runner_up[row]) / totals[row];
+        else cout << "-" << setw(12) << "-";
+        cout << "\n";
+    }
+    cout << "\nAccuracy: " << static_cast<double>(all_correct) / labelled << " (top-2 "
+         << static_cast<double>(all_top2) / labelled << ")\n";
+    cout << setprecision(1) << "Throughput: " << samples.size() / max(seconds, 1e-9) / 1e3 << " k samples/s ("
+         << seconds * 1e3 << " ms)\n";
+}
+
+// Runs the active classifier over a labelled set on the worker pool (each worker keeps
+// its own confusion counts) and reports accuracy per class and samples per second, or
+// hands labelled fused records to evaluateFusedIdentifier
+void evaluateMaterialClassifier() {
+    const size_t synthetic_samples = 1000000;
+    const size_t synthetic_materials = 500, synthetic_references = 4, synthetic_queries = 200;
+    const size_t chunk = 16384;
+    
+    int source;
+    cout << "Carrier classifier:\n";
+    cout << "1. Synthetic dataset (" << synthetic_samples << " samples)\n";
+    cout << "2. Labelled dataset file\n";
+    cout << "Fused dielectric + Hall identifier:\n";
+    cout << "3. Synthetic records (" << synthetic_materials << " materials, " << synthetic_materials * synthetic_queries
+         << " samples)\n";
+    cout << "4. Reference and labelled sample record files\n";
+    cout << "Select a dataset (1-4): ";
+    while (!(cin >> source) || source < 1 || source > 4) {
+        cout << "Invalid selection. Please enter 1-4: ";
+        clearInputBuffer();
+    }
+    
+    if (source == 3) {
+        vector<SampleRecord> records = generateLabelledFusedRecords(synthetic_materials, synthetic_references + synthetic_queries, 42);
+        vector<SampleRecord> references, samples;
+        for (size_t i = 0; i < records.size(); i++) {
+            if (i % (synthetic_references + synthetic_queries) < synthetic_references) references.push_back(records[i]);
+            else samples.push_back(records[i]);
+        }
+        evaluateFusedIdentifier(references, samples);
+        return;
+    }
+    if (source == 4) {
+        string reference_file, sample_file;
+        cout << "Reference records file: ";
+        clearInputBuffer();
+        getline(cin, reference_file);
+        cout << "Labelled sample records file: ";
+        getline(cin, sample_file);
+        vector<SampleRecord> references, samples;
+        if (!loadSampleRecords(reference_file, references)) return;
+        if (!loadSampleRecords(sample_file, samples)) return;
+        if (references.empty() || samples.empty()) {
+            cout << "\nBoth files need at least one record.\n";
+            return;
+        }
+        evaluateFusedIdentifier(references, samples);
+        return;
+    }
+    
+    LabelledCarrierSet set;
+    if (source == 1) {
+        set = generateLabelledCarrierSet(synthetic_samples, 42);
+    } else {
+        string filename;
+        cout << "Labelled dataset file: ";
+        clearInputBuffer();
+        getline(cin, filename);
+        if (!loadLabelledCarrierSet(filename, set)) return;
+    }
+    size_t n = set.labels.size();
+    if (n == 0) {
+        cout << "\nNo labelled samples to evaluate.\n";
+        return;
+    }
+    
+    const CompiledForest &forest = activeMaterialForest();
+    vector<unsigned char> predicted(n);
+    size_t num_chunks = (n + chunk - 1) / chunk;
+    vector<vector<size_t>> confusion(workerCount(num_chunks), vector<size_t>(NUM_MATERIAL_CLASSES * NUM_MATERIAL_CLASSES, 0));
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    parallelForWorkers(num_chunks, [&](unsigned worker, size_t c) {
+        size_t begin = c * chunk, count = min(chunk, n - begin);
+        classifyBatch(forest, &set.features[begin * NUM_CARRIER_FEATURES], count, &predicted[begin]);
+        size_t *counts = &confusion[worker][0];
+        for (size_t i = begin; i < begin + count; i++) counts[set.labels[i] * NUM_MATERIAL_CLASSES + predicted[i]]++;
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    size_t matrix[NUM_MATERIAL_CLASSES][NUM_MATERIAL_CLASSES] = {{0}};
+    for (size_t w = 0; w < confusion.size(); w++) {
+        for (int t = 0; t < NUM_MATERIAL_CLASSES; t++) {
+            for (int p = 0; p < NUM_MATERIAL_CLASSES; p++) matrix[t][p] += confusion[w][t * NUM_MATERIAL_CLASSES + p];
+        }
+    }
+    
+    const char *short_names[NUM_MATERIAL_CLASSES] = {"Metal", "n-type", "p-type", "Insul.", "HeavyDop"};
+    size_t correct = 0;
+    cout << "\n------ CLASSIFIER EVALUATION (" << n << " samples) ------\n";
+    cout << "Confusion matrix (rows: true class, columns: predicted)\n";
+    cout << setw(10) << "";
+    for (int p = 0; p < NUM_MATERIAL_CLASSES; p++) cout << setw(10) << short_names[p];
+    cout << "\n";
+    for (int t = 0; t < NUM_MATERIAL_CLASSES; t++) {
+        cout << setw(10) << short_names[t];
+        for (int p = 0; p < NUM_MATERIAL_CLASSES; p++) cout << setw(10) << matrix[t][p];
+        cout << "\n";
+        correct += matrix[t][t];
+    }
+    
+    cout << fixed << setprecision(4);
+    cout << "\n" << setw(10) << "Class" << setw(12) << "Precision" << setw(12) << "Recall" << "\n";
+    for (int c = 0; c < NUM_MATERIAL_CLASSES; c++) {
+        size_t predicted_total = 0, true_total = 0;
+        for (int k = 0; k < NUM_MATERIAL_CLASSES; k++) {
+            predicted_total += matrix[k][c];
+            true_total += matrix[c][k];
+        }
+        cout << setw(10) << short_names[c] << setw(12);
+        if (predicted_total) cout << static_cast<double>(matrix[c][c]) / predicted_total; else cout << "-";
+        cout << setw(12);
+        if (true_total) cout << static_cast<double>(matrix[c][c]) / true_total; else cout << "-";
+        cout << "\n";
+    }
+    cout << "\nAccuracy: " << static_cast<double>(correct) / n << "\n";
+    cout << setprecision(1) << "Throughput: " << n / max(seconds, 1e-9) / 1e6 << " M samples/s ("
+         << seconds * 1e3 << " ms)\n";
+}
+
+// Refuses a material name that does not fit the record rather than cutting it, since two
+// names with the same prefix would then merge into one series in every run-store tool
+bool makeRunRecord(const Sample &sample, const RunResult &result, RunRecord &record) {
+    const double nan = numeric_limits<double>::quiet_NaN();
+    if (sample.name.size() > max_material_name) {
+        cout << "\nError: Material name '" << sample.name << "' is longer than " << max_material_name
+             << " bytes; run not stored.\n";
+        return false;
+    }
+    memset(&record, 0, sizeof(record));
+    record.timestamp = static_cast<int64_t>(time(0));
+    memcpy(record.material, sample.name.data(), sample.name.size());
+    
+    bool fitted = sample.curie_temp_C > 0 && result.prediction.peak_passed;
+    record.curie_estimate_C = sample.curie_temp_C > 0 ? (fitted ? result.prediction.predicted_curie_C : result.peak_temp) : nan;
+    record.expected_curie_C = sample.curie_temp_C;
+    record.peak_epsilon = result.peak_epsilon;
+    record.curie_weiss_T0_C = fitted ? result.prediction.curie_weiss_T0_C : nan;
+    record.curie_constant = fitted ? result.prediction.curie_constant : nan;
+    record.num_readings = static_cast<int32_t>(result.num_readings);
+    return true;
+}
+
+bool appendRunRecords(const vector<RunRecord> &records) {
+    if (records.empty()) return true;
+    ofstream file(run_store_file, ios::binary | ios::app);
+    if (!file.is_open()) {
+        cout << "\nError: Could not open run store '" << run_store_file << "'.\n";
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(&records[0]), records.size() * sizeof(RunRecord));
+    if (!file) return false;
+    countMetric(METRIC_RUNS_STORED, records.size());
+    return true;
+}
+
+// Reads the run store in blocks and scatters each record into the columns
+bool loadRunColumns(const string &filename, RunColumns &runs) {
+    ifstream file(filename.c_str(), ios::binary);
+    if (!file.is_open()) {
+        cout << "\nError: Could not open run store '" << filename << "'.\n";
+        return false;
+    }
+    
+    file.seekg(0, ios::end);
+    size_t total = static_cast<size_t>(file.tellg()) / sizeof(RunRecord);
+    file.seekg(0, ios::beg);
+    runs.material_id.reserve(total);
+    runs.timestamp.reserve(total);
+    runs.curie_estimate.reserve(total);
+    runs.expected_curie.reserve(total);
+    runs.peak_epsilon.reserve(total);
+    runs.curie_weiss_T0.reserve(total);
+    runs.curie_constant.reserve(total);
+    runs.num_readings.reserve(total);
+    
+    map<string, uint16_t> dictionary;
+    for (size_t i = 0; i < runs.materials.size(); i++) dictionary[runs.materials[i]] = static_cast<uint16_t>(i);
+    
+    const size_t block = 65536;
+    vector<RunRecord> buffer(block);
+    while (file) {
+        file.read(reinterpret_cast<char *>(&buffer[0]), block * sizeof(RunRecord));
+        size_t count = static_cast<size_t>(file.gcount()) / sizeof(RunRecord);
+        for (size_t i = 0; i < count; i++) {
+            const RunRecord &r = buffer[i];
+            const char *terminator = static_cast<const char *>(memchr(r.material, '\0', sizeof(r.material)));
+            string material(r.material, terminator ? terminator - r.material : sizeof(r.material));
+            map<string, uint16_t>::iterator it = dictionary.find(material);
+            if (it == dictionary.end()) {
+                if (runs.materials.size() == max_run_materials) {
+                    cout << "\nError: Run store '" << filename << "' holds more than " << max_run_materials
+                         << " distinct materials.\n";
+                    return false;
+                }
+                it = dictionary.insert(make_pair(material, static_cast<uint16_t>(runs.materials.size()))).first;
+                runs.materials.push_back(material);
+            }
+            runs.material_id.push_back(it->second);
+            runs.timestamp.push_back(r.timestamp);
+            runs.curie_estimate.push_back(static_cast<float>(r.curie_estimate_C));
+            runs.expected_curie.push_back(static_cast<float>(r.expected_curie_C));
+            runs.peak_epsilon.push_back(static_cast<float>(r.peak_epsilon));
+            runs.curie_weiss_T0.push_back(static_cast<float>(r.curie_weiss_T0_C));
+            runs.curie_constant.push_back(static_cast<float>(r.curie_constant));
+            runs.num_readings.push_back(r.num_readings);
+        }
+    }
+    return true;
+}
+
+// Assigns points [begin, end) to their nearest centroid. The loop over points for one
+// centroid is straight column arithmetic with a select for the running minimum, so it
+// vectorises; best[] and label[] are scratch arrays for the range.
+static void assignToCentroids(const vector<const float *> &columns, const double *centroids, int k,
+                              size_t begin, size_t end, float *best, uint8_t *label) {
+    size_t count = end - begin;
+    for (size_t i = 0; i < count; i++) {
+        best[i] = numeric_limits<float>::max();
+        label[i] = 0;
+    }
+    for (int c = 0; c < k; c++) {
+        for (size_t i = 0; i < count; i++) {
+            float distance = 0;
+            for (int d = 0; d < NUM_RUN_FEATURES; d++) {
+                float diff = columns[d][begin + i] - static_cast<float>(centroids[c * NUM_RUN_FEATURES + d]);
+                distance += diff * diff;
+            }
+            bool closer = distance < best[i];
+            best[i] = closer ? distance : best[i];
+            label[i] = closer ? static_cast<uint8_t>(c) : label[i];
+        }
+    }
+}
+
+// k-means over standardised feature columns, seeded with k-means++. Lloyd iterations
+// split the points into chunks on the worker pool, each worker summing its own chunk's
+// points per cluster before the sums are merged. The mini-batch variant updates the
+// centroids from small random batches with per-centroid learning rates, then makes one
+// full assignment pass.
+KMeansResult kMeansCluster(const vector<const float *> &columns, size_t n, int k, bool mini_batch, unsigned seed) {
+    const int max_iterations = 100;
+    const int mini_batch_iterations = 200;
+    const size_t mini_batch_size = 4096;
+    const size_t chunk = 65536;
+    const double tolerance = 1e-6;
+    
+    KMeansResult result;
+    result.k = k;
+    result.iterations = 0;
+    result.inertia = 0;
+    result.centroids.assign(k * NUM_RUN_FEATURES, 0.0);
+    result.assignment.assign(n, 0);
+    result.counts.assign(k, 0);
+    if (n == 0) return result;
+    
+    mt19937 rng(seed);
+    size_t num_chunks = (n + chunk - 1) / chunk;
+    vector<float> best(n);
+    
+    // k-means++: each new centroid drawn with probability proportional to D²
+    size_t first = rng() % n;
+    for (int d = 0; d < NUM_RUN_FEATURES; d++) result.centroids[d] = columns[d][first];
+    for (int c = 1; c < k; c++) {
+        parallelFor(num_chunks, [&](size_t ch) {
+            size_t begin = ch * chunk, end = min(n, begin + chunk);
+            vector<uint8_t> label(end - begin);
+            assignToCentroids(columns, &result.centroids[0], c, begin, end, &best[begin], &label[0]);
+        });
+        double total = 0;
+        for (size_t i = 0; i < n; i++) total += best[i];
+        double target = uniform_real_distribution<double>(0.0, total)(rng);
+        size_t chosen = n - 1;
+        for (size_t i = 0; i < n; i++) {
+            target -= best[i];
+            if (target <= 0) { chosen = i; break; }
+        }
+        for (int d = 0; d < NUM_RUN_FEATURES; d++) result.centroids[c * NUM_RUN_FEATURES + d] = columns[d][chosen];
+    }
+    
+    if (mini_batch) {
+        vector<double> seen(k, 0.0);
+        vector<size_t> batch(mini_batch_size);
+        vector<float> batch_best(mini_batch_size);
+        vector<uint8_t> batch_label(mini_batch_size);
+        vector<float> batch_columns(NUM_RUN_FEATURES * mini_batch_size);
+        vector<const float *> batch_pointers(NUM_RUN_FEATURES);
+        for (int d = 0; d < NUM_RUN_FEATURES; d++) batch_pointers[d] = &batch_columns[d * mini_batch_size];
+        
+        for (result.iterations = 0; result.iterations < mini_batch_iterations; result.iterations++) {
+            for (size_t b = 0; b < mini_batch_size; b++) {
+                batch[b] = rng() % n;
+                for (int d = 0; d < NUM_RUN_FEATURES; d++) batch_columns[d * mini_batch_size + b] = columns[d][batch[b]];
+            }
+            assignToCentroids(batch_pointers, &result.centroids[0], k, 0, mini_batch_size, &batch_best[0], &batch_label[0]);
+            for (size_t b = 0; b < mini_batch_size; b++) {
+                int c = batch_label[b];
+                double rate = 1.0 / ++seen[c];
+                for (int d = 0; d < NUM_RUN_FEATURES; d++) {
+                    double &centroid = result.centroids[c * NUM_RUN_FEATURES + d];
+                    centroid += rate * (batch_columns[d * mini_batch_size + b] - centroid);
+                }
+            }
+        }
+    }
+    
+    // Lloyd iterations (a single assignment pass after mini-batch updates)
+    int iterations = mini_batch ? 1 : max_iterations;
+    vector<vector<double>> sums(workerCount(num_chunks), vector<double>(k * NUM_RUN_FEATURES));
+    vector<vector<size_t>> counts(workerCount(num_chunks), vector<size_t>(k));
+    vector<double> inertia(workerCount(num_chunks));
+    double previous = numeric_limits<double>::max();
+    
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        for (size_t w = 0; w < sums.size(); w++) {
+            fill(sums[w].begin(), sums[w].end(), 0.0);
+            fill(counts[w].begin(), counts[w].end(), 0);
+            inertia[w] = 0;
+        }
+        parallelForWorkers(num_chunks, [&](unsigned worker, size_t ch) {
+            size_t begin = ch * chunk, end = min(n, begin + chunk);
+            assignToCentroids(columns, &result.centroids[0], k, begin, end, &best[begin], &result.assignment[begin]);
+            for (size_t i = begin; i < end; i++) {
+                int c = result.assignment[i];
+                counts[worker][c]++;
+                inertia[worker] += best[i];
+                for (int d = 0; d < NUM_RUN_FEATURES; d++) sums[worker][c * NUM_RUN_FEATURES + d] += columns[d][i];
+            }
+        });
+        
+        result.inertia = 0;
+        fill(result.counts.begin(), result.counts.end(), 0);
+        vector<double> total(k * NUM_RUN_FEATURES, 0.0);
+        for (size_t w = 0; w < sums.size(); w++) {
+            result.inertia += inertia[w];
+            for (int c = 0; c < k; c++) {
+                result.counts[c] += counts[w][c];
+                for (int d = 0; d < NUM_RUN_FEATURES; d++) total[c * NUM_RUN_FEATURES + d] += sums[w][c * NUM_RUN_FEATURES + d];
+            }
+        }
+        if (!mini_batch) {
+            result.iterations = iteration + 1;
+            for (int c = 0; c < k; c++) {
+                if (result.counts[c] == 0) continue; // empty cluster keeps its centroid
+                for (int d = 0; d < NUM_RUN_FEATURES; d++) {
+                    result.centroids[c * NUM_RUN_FEATURES + d] = total[c * NUM_RUN_FEATURES + d] / result.counts[c];
+                }
+            }
+            if (previous - result.inertia <= tolerance * previous) break;
+            previous = result.inertia;
+        }
+    }
+    return result;
+}
+
+// Clusters the stored runs of one material on Curie estimate, peak ε and the Curie-Weiss
+// parameters. Small clusters are flagged as anomalous lots with the dates they span.
+void clusterRuns() {
+    const double anomalous_share = 0.02;
+    
+    RunColumns runs;
+    if (!loadRunColumns(run_store_file, runs)) return;
+    if (runs.size() == 0) {
+        cout << "\nThe run store is empty.\n";
+        return;
+    }
+    
+    cout << "\nMaterials in the run store:\n";
+    for (size_t m = 0; m < runs.materials.size(); m++) cout << m + 1 << ". " << runs.materials[m] << "\n";
+    int material_choice, k, mode;
+    cout << "Select a material (1-" << runs.materials.size() << "): ";
+    while (!(cin >> material_choice) || material_choice < 1 || material_choice > static_cast<int>(runs.materials.size())) {
+        cout << "Invalid selection. Please enter a number between 1 and " << runs.materials.size() << ": ";
+        clearInputBuffer();
+    }
+    cout << "Number of clusters (2-16): ";
+    while (!(cin >> k) || k < 2 || k > 16) {
+        cout << "Invalid input. Please enter a number between 2 and 16: ";
+        clearInputBuffer();
+    }
+    cout << "1. Full k-means\n2. Mini-batch k-means\nSelect a mode (1-2): ";
+    while (!(cin >> mode) || mode < 1 || mode > 2) {
+        cout << "Invalid selection. Please enter 1 or 2: ";
+        clearInputBuffer();
+    }
+    
+    // Standardised feature columns for runs of this material with a Curie-Weiss fit
+    const vector<float> *raw[NUM_RUN_FEATURES] = {&runs.curie_estimate, &runs.peak_epsilon, &runs.curie_weiss_T0, &runs.curie_constant};
+    const char *feature_names[NUM_RUN_FEATURES] = {"Curie (°C)", "Peak ε", "T0 (°C)", "C (K)"};
+    uint16_t material = static_cast<uint16_t>(material_choice - 1);
+    vector<size_t> rows;
+    for (size_t i = 0; i < runs.size(); i++) {
+        bool complete = runs.material_id[i] == material;
+        for (int d = 0; d < NUM_RUN_FEATURES && complete; d++) complete = (*raw[d])[i] == (*raw[d])[i];
+        if (complete) rows.push_back(i);
+    }
+    if (rows.size() < static_cast<size_t>(k)) {
+        cout << "\nNot enough runs with a Curie-Weiss fit (" << rows.size() << ") for " << k << " clusters.\n";
+        return;
+    }
+    
+    vector<vector<float>> standardised(NUM_RUN_FEATURES, vector<float>(rows.size()));
+    vector<const float *> columns(NUM_RUN_FEATURES);
+    double mean[NUM_RUN_FEATURES], spread[NUM_RUN_FEATURES];
+    for (int d = 0; d < NUM_RUN_FEATURES; d++) {
+        double sum = 0, sum_sq = 0;
+        for (size_t r = 0; r < rows.size(); r++) {
+            double v = (*raw[d])[rows[r]];
+            sum += v;
+            sum_sq += v * v;
+        }
+        mean[d] = sum / rows.size();
+        double variance = sum_sq / rows.size() - mean[d] * mean[d];
+        spread[d] = variance > 0 ? sqrt(variance) : 1.0;
+        for (size_t r = 0; r < rows.size(); r++) standardised[d][r] = static_cast<float>(((*raw[d])[rows[r]] - mean[d]) / spread[d]);
+        columns[d] = &standardised[d][0];
+    }
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    KMeansResult clusters = kMeansCluster(columns, rows.size(), k, mode == 2, 7);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    // Dates spanned by the central 90% of each cluster's runs, so a few stray runs from
+    // other lots do not stretch the range
+    vector<vector<int64_t>> times(k);
+    for (size_t r = 0; r < rows.size(); r++) times[clusters.assignment[r]].push_back(runs.timestamp[rows[r]]);
+    vector<int64_t> first_run(k), last_run(k);
+    for (int c = 0; c < k; c++) {
+        if (times[c].empty()) continue;
+        vector<int64_t>::iterator low = times[c].begin() + times[c].size() / 20;
+        vector<int64_t>::iterator high = times[c].begin() + (times[c].size() - 1) * 19 / 20;
+        nth_element(times[c].begin(), low, times[c].end());
+        first_run[c] = *low;
+        nth_element(times[c].begin(), high, times[c].end());
+        last_run[c] = *high;
+    }
+    
+    cout << "\n------ RUN CLUSTERS: " << runs.materials[material] << " (" << rows.size() << " runs) ------\n";
+    cout << setw(8) << "Cluster" << setw(10) << "Runs";
+    for (int d = 0; d < NUM_RUN_FEATURES; d++) cout << setw(14) << feature_names[d];
+    cout << "   Dates\n";
+    for (int c = 0; c < k; c++) {
+        cout << setw(8) << c + 1 << setw(10) << clusters.counts[c] << fixed << setprecision(2);
+        for (int d = 0; d < NUM_RUN_FEATURES; d++) {
+            cout << setw(14) << clusters.centroids[c * NUM_RUN_FEATURES + d] * spread[d] + mean[d];
+        }
+        if (clusters.counts[c] > 0) {
+            char from[16], to[16];
+            time_t t0 = static_cast<time_t>(first_run[c]), t1 = static_cast<time_t>(last_run[c]);
+            strftime(from, sizeof(from), "%Y-%m-%d", gmtime(&t0));
+            strftime(to, sizeof(to), "%Y-%m-%d", gmtime(&t1));
+            cout << "   " << from << " .. " << to;
+        }
+        if (clusters.counts[c] > 0 && clusters.counts[c] < anomalous_share * rows.size()) cout << "   << anomalous";
+        cout << "\n";
+    }
+    cout << setprecision(1) << "\n" << (mode == 2 ? "Mini-batch" : "Full") << " k-means: " << clusters.iterations
+         << " iterations, inertia " << clusters.inertia << ", " << seconds * 1e3 << " ms\n";
+}
+
+SpcState newSpcState(const string &material, double target) {
+    SpcState state;
+    state.material = material;
+    state.target = target;
+    state.runs = 0;
+    state.baseline_mean = state.baseline_m2 = 0;
+    state.sigma = 0;
+    state.ewma = target;
+    state.cusum_high = state.cusum_low = 0;
+    state.alarm = false;
+    state.alarms = 0;
+    state.last_alarm = 0;
+    return state;
+}
+
+// Adds one run to a chart; returns true when this run raised a new alarm
+bool updateSpc(SpcState &state, double curie_estimate, int64_t timestamp) {
+    state.runs++;
+    if (state.runs <= static_cast<size_t>(spc_baseline_runs)) {
+        double delta = curie_estimate - state.baseline_mean;
+        state.baseline_mean += delta / state.runs;
+        state.baseline_m2 += delta * (curie_estimate - state.baseline_mean);
+        if (state.runs == static_cast<size_t>(spc_baseline_runs)) {
+            state.sigma = max(spc_min_sigma, sqrt(state.baseline_m2 / (state.runs - 1)));
+            state.ewma = state.baseline_mean;
+        }
+        return false;
+    }
+    
+    double centre = state.baseline_mean;
+    state.ewma = spc_lambda * curie_estimate + (1.0 - spc_lambda) * state.ewma;
+    double z = (curie_estimate - centre) / state.sigma;
+    state.cusum_high = max(0.0, state.cusum_high + z - spc_cusum_k);
+    state.cusum_low = max(0.0, state.cusum_low - z - spc_cusum_k);
+    
+    double ewma_limit = spc_ewma_limit * state.sigma * sqrt(spc_lambda / (2.0 - spc_lambda));
+    bool out = fabs(state.ewma - centre) > ewma_limit || state.cusum_high > spc_cusum_h || state.cusum_low > spc_cusum_h;
+    // A raised alarm clears only well inside the limits, so a chart hovering at a
+    // limit does not count the same shift again and again
+    bool settled = fabs(state.ewma - centre) <= spc_clear_fraction * ewma_limit &&
+                   max(state.cusum_high, state.cusum_low) <= spc_clear_fraction * spc_cusum_h;
+    
+    bool raised = out && !state.alarm;
+    state.alarm = out || (state.alarm && !settled);
+    if (raised) {
+        state.alarms++;
+        state.last_alarm = timestamp;
+    }
+    return raised;
+}
+
+// Tab-separated, one chart per line, in the SpcState field order
+bool loadSpcStates(map<string, SpcState> &states) {
+    ifstream file(spc_state_file);
+    if (!file.is_open()) return false;
+    string line;
+    while (getline(file, line)) {
+        istringstream in(line);
+        SpcState state;
+        long long last_alarm;
+        int alarm;
+        if (getline(in, state.material, '\t') &&
+            in >> state.target >> state.runs >> state.baseline_mean >> state.baseline_m2 >> state.sigma >> state.ewma
+               >> state.cusum_high >> state.cusum_low >> alarm >> state.alarms >> last_alarm) {
+            state.alarm = alarm != 0;
+            state.last_alarm = last_alarm;
+            states[state.material] = state;
+        }
+    }
+    return true;
+}
+
+bool saveSpcStates(const map<string, SpcState> &states) {
+    ofstream file(spc_state_file);
+    if (!file.is_open()) {
+        cout << "\nError: Could not write '" << spc_state_file << "'.\n";
+        return false;
+    }
+    file << setprecision(17);
+    for (map<string, SpcState>::const_iterator it = states.begin(); it != states.end(); ++it) {
+        const SpcState &s = it->second;
+        file << s.material << "\t" << s.target << "\t" << s.runs << "\t" << s.baseline_mean << "\t" << s.baseline_m2
+             << "\t" << s.sigma << "\t" << s.ewma << "\t" << s.cusum_high << "\t" << s.cusum_low << "\t"
+             << (s.alarm ? 1 : 0) << "\t" << s.alarms << "\t" << static_cast<long long>(s.last_alarm) << "\n";
+    }
+    return true;
+}
+
+// Feeds newly stored runs into their charts and warns when a run signals drift
+void updateSpcForRuns(const vector<RunRecord> &records) {
+    map<string, SpcState> states;
+    loadSpcStates(states);
+    bool changed = false;
+    for (size_t i = 0; i < records.size(); i++) {
+        const RunRecord &r = records[i];
+        if (r.curie_estimate_C != r.curie_estimate_C) continue; // no Curie temperature to chart
+        string material(r.material);
+        if (!states.count(material)) states[material] = newSpcState(material, r.expected_curie_C);
+        SpcState &state = states[material];
+        if (updateSpc(state, r.curie_estimate_C, r.timestamp)) {
+            cout << fixed << setprecision(2) << "\n>> SPC alarm for " << material << ": Curie EWMA " << state.ewma
+                 << "°C vs baseline " << state.baseline_mean << "°C (CUSUM +" << state.cusum_high << " / -" << state.cusum_low << ").\n";
+        }
+        changed = true;
+    }
+    if (changed) saveSpcStates(states);
+}
+
+// Rebuilds every chart from the run store: runs are grouped by material, ordered by time,
+// and the materials are replayed in parallel
+map<string, SpcState> backfillSpc(const RunColumns &runs) {
+    vector<vector<size_t>> rows(runs.materials.size());
+    for (size_t i = 0; i < runs.size(); i++) {
+        if (runs.curie_estimate[i] == runs.curie_estimate[i]) rows[runs.material_id[i]].push_back(i);
+    }
+    
+    vector<SpcState> charts(runs.materials.size());
+    parallelFor(runs.materials.size(), [&](size_t m) {
+        vector<size_t> &order = rows[m];
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return runs.timestamp[a] < runs.timestamp[b]; });
+        charts[m] = newSpcState(runs.materials[m], order.empty() ? 0 : runs.expected_curie[order[0]]);
+        for (size_t j = 0; j < order.size(); j++) updateSpc(charts[m], runs.curie_estimate[order[j]], runs.timestamp[order[j]]);
+    });
+    
+    map<string, SpcState> states;
+    for (size_t m = 0; m < charts.size(); m++) {
+        if (!rows[m].empty()) states[charts[m].material] = charts[m];
+    }
+    return states;
+}
+
+void showSpcCharts() {
+    int choice;
+    cout << "1. Show current charts\n2. Rebuild charts from the run store\nSelect (1-2): ";
+    while (!(cin >> choice) || choice < 1 || choice > 2) {
+        cout << "Invalid selection. Please enter 1 or 2: ";
+        clearInputBuffer();
+    }
+    
+    map<string, SpcState> states;
+    if (choice == 2) {
+        RunColumns runs;
+        if (!loadRunColumns(run_store_file, runs)) return;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        states = backfillSpc(runs);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        saveSpcStates(states);
+        cout << fixed << setprecision(1) << "\nReplayed " << runs.size() << " runs in " << seconds * 1e3 << " ms.\n";
+    } else if (!loadSpcStates(states)) {
+        cout << "\nNo charts yet. Store some runs or rebuild from the run store.\n";
+        return;
+    }
+    
+    cout << "\n------ CURIE TEMPERATURE SPC ------\n";
+    cout << left << setw(20) << "Material" << right << setw(10) << "Runs" << setw(10) << "Target" << setw(10) << "Centre" << setw(10) << "Sigma"
+         << setw(10) << "EWMA" << setw(10) << "CUSUM+" << setw(10) << "CUSUM-" << "   Status\n";
+    for (map<string, SpcState>::iterator it = states.begin(); it != states.end(); ++it) {
+        const SpcState &s = it->second;
+        cout << left << setw(20) << s.material << right << setw(10) << s.runs << fixed << setprecision(2)
+             << setw(10) << s.target << setw(10) << s.baseline_mean << setw(10) << s.sigma << setw(10) << s.ewma << setw(10) << s.cusum_high
+             << setw(10) << s.cusum_low << "   ";
+        char date[16] = "";
+        time_t t = static_cast<time_t>(s.last_alarm);
+        if (s.alarms > 0) strftime(date, sizeof(date), "%Y-%m-%d", gmtime(&t));
+        if (s.runs < static_cast<size_t>(spc_baseline_runs)) {
+            cout << "baseline (" << s.runs << "/" << spc_baseline_runs << ")";
+        } else if (s.alarm) {
+            cout << "DRIFT since " << date;
+        } else {
+            cout << "in control";
+        }
+        if (s.alarms > 0) cout << " (" << s.alarms << " alarm(s), latest " << date << ")";
+        cout << "\n";
+    }
+}
+
+// First second of a UTC calendar day, by the days-from-civil algorithm (no timegm in C++11)
+static int64_t utcDayStart(int year, int month, int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return (era * 146097 + day_of_era - 719468) * 86400;
+}
+
+// Parses one filter: "<column> <op> <value>" with op one of < <= > >= = !=, or
+// "<column> between|outside <low> <high>". Dates are YYYY-MM-DD, meaning that whole UTC
+// day as the rollups count it, or Nd for the instant N days ago; material takes a name
+// from the run store.
+bool parseRunPredicate(const string &text, const RunColumns &runs, RunPredicate &predicate, string &error) {
+    istringstream in(text);
+    string column, op;
+    if (!(in >> column >> op)) {
+        error = "expected <column> <op> <value>";
+        return false;
+    }
+    int c = 0;
+    while (c < NUM_RUN_COLUMNS && column != run_column_names[c]) c++;
+    if (c == NUM_RUN_COLUMNS) {
+        error = "unknown column '" + column + "'";
+        return false;
+    }
+    predicate.column = static_cast<RunColumn>(c);
+    
+    const char *ops[] = {"<", "<=", ">", ">=", "=", "!=", "between", "outside"};
+    int o = 0;
+    while (o < 8 && op != ops[o]) o++;
+    if (o == 8) {
+        error = "unknown operator '" + op + "'";
+        return false;
+    }
+    predicate.op = static_cast<PredicateOp>(o);
+    
+    if (predicate.column == COL_MATERIAL) {
+        if (predicate.op != OP_EQ && predicate.op != OP_NE) {
+            error = "material only supports = and !=";
+            return false;
+        }
+        string name;
+        getline(in >> ws, name);
+        size_t m = 0;
+        while (m < runs.materials.size() && runs.materials[m] != name) m++;
+        if (m == runs.materials.size()) {
+            error = "no runs of material '" + name + "'";
+            return false;
+        }
+        predicate.low = predicate.high = static_cast<double>(m);
+        return true;
+    }
+    
+    int num_values = predicate.op >= OP_BETWEEN ? 2 : 1;
+    double values[2] = {0, 0};
+    int64_t day_end[2] = {0, 0};  // dates: first second after each value's span
+    for (int v = 0; v < num_values; v++) {
+        string token;
+        if (!(in >> token)) {
+            error = "missing value";
+            return false;
+        }
+        char *end = 0;
+        bool ok;
+        if (predicate.column == COL_DATE && !token.empty() && token[token.size() - 1] == 'd') {
+            double days = strtod(token.c_str(), &end);
+            ok = end == token.c_str() + token.size() - 1;
+            values[v] = floor(static_cast<double>(time(0)) - days * 86400.0);
+            day_end[v] = static_cast<int64_t>(values[v]) + 1;
+        } else if (predicate.column == COL_DATE) {
+            int year, month, day;
+            ok = sscanf(token.c_str(), "%d-%d-%d", &year, &month, &day) == 3 && month >= 1 && month <= 12 &&
+                 day >= 1 && day <= 31;
+            if (ok) {
+                values[v] = static_cast<double>(utcDayStart(year, month, day));
+                day_end[v] = utcDayStart(year, month, day) + 86400;
+            }
+        } else {
+            values[v] = strtod(token.c_str(), &end);
+            ok = end == token.c_str() + token.size();
+        }
+        if (!ok) {
+            error = "bad value '" + token + "'";
+            return false;
+        }
+    }
+    predicate.low = min(values[0], values[num_values - 1]);
+    predicate.high = max(values[0], values[num_values - 1]);
+    if (predicate.column == COL_DATE) {
+        // Timestamps are whole seconds, so a span [start, end) is [start, end - 1]. Bounds
+        // that take in a date take its whole span; "= D" is the span itself.
+        int64_t last = max(day_end[0], day_end[num_values - 1]) - 1;
+        switch (predicate.op) {
+            case OP_LE: case OP_GT: predicate.low = static_cast<double>(last); break;
+            case OP_EQ: predicate.op = OP_BETWEEN; predicate.high = static_cast<double>(last); break;
+            case OP_NE: predicate.op = OP_OUTSIDE; predicate.high = static_cast<double>(last); break;
+            case OP_BETWEEN: case OP_OUTSIDE: predicate.high = static_cast<double>(last); break;
+            default: break;
+        }
+    }
+    return true;
+}
+
+// ANDs one predicate over a block into mask. Each case is a plain loop with no branch
+// in the body, so the compiler vectorises it; NaN compares false and never matches.
+template <typename T>
+static void applyPredicate(const T *x, size_t n, PredicateOp op, T low, T high, uint8_t *mask) {
+    switch (op) {
+        case OP_LT: for (size_t i = 0; i < n; i++) mask[i] &= x[i] < low; break;
+        case OP_LE: for (size_t i = 0; i < n; i++) mask[i] &= x[i] <= low; break;
+        case OP_GT: for (size_t i = 0; i < n; i++) mask[i] &= x[i] > low; break;
+        case OP_GE: for (size_t i = 0; i < n; i++) mask[i] &= x[i] >= low; break;
+        case OP_EQ: for (size_t i = 0; i < n; i++) mask[i] &= x[i] == low; break;
+        case OP_NE: for (size_t i = 0; i < n; i++) mask[i] &= x[i] != low; break;
+        case OP_BETWEEN: for (size_t i = 0; i < n; i++) mask[i] &= (x[i] >= low) & (x[i] <= high); break;
+        case OP_OUTSIDE: for (size_t i = 0; i < n; i++) mask[i] &= (x[i] < low) | (x[i] > high); break;
+    }
+}
+
+// Numeric column values for rows [begin, begin + n): a pointer into the store, or the
+// derived values written to scratch
+static const float *numericColumn(const RunColumns &runs, RunColumn column, size_t begin, size_t n, float *scratch) {
+    switch (column) {
+        case COL_CURIE: return &runs.curie_estimate[begin];
+        case COL_EXPECTED: return &runs.expected_curie[begin];
+        case COL_PEAK_EPSILON: return &runs.peak_epsilon[begin];
+        case COL_CURIE_WEISS_T0: return &runs.curie_weiss_T0[begin];
+        case COL_CURIE_CONSTANT: return &runs.curie_constant[begin];
+        case COL_DEVIATION:
+            for (size_t i = 0; i < n; i++) scratch[i] = runs.curie_estimate[begin + i] - runs.expected_curie[begin + i];
+            return scratch;
+        default:
+            for (size_t i = 0; i < n; i++) scratch[i] = static_cast<float>(runs.num_readings[begin + i]);
+            return scratch;
+    }
+}
+
+// Scans the store in blocks of cache-sized chunks on the worker pool. Each worker keeps
+// its own group accumulators, merged at the end; max_rows matching rows are kept for display.
+QueryResult runQuery(const RunColumns &runs, const RunQuery &query, size_t max_rows) {
+    const size_t block = 16384;
+    size_t n = runs.size();
+    size_t num_blocks = (n + block - 1) / block;
+    size_t num_groups = query.group_by_material ? max<size_t>(runs.materials.size(), 1) : 1;
+    
+    QueryGroup empty_group = {0, 0, 0, 0, numeric_limits<double>::infinity(), -numeric_limits<double>::infinity()};
+    unsigned num_workers = workerCount(num_blocks);
+    vector<vector<QueryGroup>> worker_groups(num_workers, vector<QueryGroup>(num_groups, empty_group));
+    vector<vector<uint8_t>> worker_mask(num_workers, vector<uint8_t>(block));
+    vector<vector<float>> worker_scratch(num_workers, vector<float>(block));
+    vector<vector<size_t>> block_rows(num_blocks);
+    
+    parallelForWorkers(num_blocks, [&](unsigned worker, size_t b) {
+        size_t begin = b * block, count = min(block, n - begin);
+        uint8_t *mask = &worker_mask[worker][0];
+        float *scratch = &worker_scratch[worker][0];
+        memset(mask, 1, count);
+        
+        for (size_t f = 0; f < query.filters.size(); f++) {
+            const RunPredicate &p = query.filters[f];
+            if (p.column == COL_DATE) {
+                applyPredicate<int64_t>(&runs.timestamp[begin], count, p.op, static_cast<int64_t>(p.low),
+                                        static_cast<int64_t>(p.high), mask);
+            } else if (p.column == COL_MATERIAL) {
+                applyPredicate<uint16_t>(&runs.material_id[begin], count, p.op, static_cast<uint16_t>(p.low),
+                                         static_cast<uint16_t>(p.high), mask);
+            } else {
+                applyPredicate<float>(numericColumn(runs, p.column, begin, count, scratch), count, p.op,
+                                      static_cast<float>(p.low), static_cast<float>(p.high), mask);
+            }
+        }
+        
+        const float *values = numericColumn(runs, query.aggregate, begin, count, scratch);
+        vector<QueryGroup> &groups = worker_groups[worker];
+        for (size_t i = 0; i < count; i++) {
+            if (!mask[i]) continue;
+            QueryGroup &g = groups[query.group_by_material ? runs.material_id[begin + i] : 0];
+            g.count++;
+            double v = values[i];
+            if (v != v) continue;
+            g.valued++;
+            g.sum += v;
+            g.sum_sq += v * v;
+            g.min = min(g.min, v);
+            g.max = max(g.max, v);
+        }
+        for (size_t i = 0; i < count && block_rows[b].size() < max_rows; i++) {
+            if (mask[i]) block_rows[b].push_back(begin + i);
+        }
+    });
+    
+    QueryResult result;
+    result.groups.assign(num_groups, empty_group);
+    for (unsigned w = 0; w < num_workers; w++) {
+        for (size_t g = 0; g < num_groups; g++) {
+            const QueryGroup &from = worker_groups[w][g];
+            QueryGroup &to = result.groups[g];
+            to.count += from.count;
+            to.valued += from.valued;
+            to.sum += from.sum;
+            to.sum_sq += from.sum_sq;
+            to.min = min(to.min, from.min);
+            to.max = max(to.max, from.max);
+        }
+    }
+    for (size_t b = 0; b < num_blocks && result.first_rows.size() < max_rows; b++) {
+        for (size_t r = 0; r < block_rows[b].size() && result.first_rows.size() < max_rows; r++) {
+            result.first_rows.push_back(block_rows[b][r]);
+        }
+    }
+    return result;
+}
+
+// Loads the run store once, then answers queries until an empty filter list
+void queryRuns() {
+    const size_t max_rows = 20;
+    
+    RunColumns runs;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!loadRunColumns(run_store_file, runs)) return;
+    double load_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << fixed << setprecision(1) << "\nLoaded " << runs.size() << " runs in " << load_seconds * 1e3 << " ms.\n";
+    cout << "Columns:";
+    for (int c = 0; c < NUM_RUN_COLUMNS; c++) cout << " " << run_column_names[c];
+    cout << "\nFilters: <column> <op> <value> with op < <= > >= = !=, or <column> between|outside <low> <high>\n";
+    cout << "Dates are YYYY-MM-DD (a whole UTC day) or Nd (N days ago), e.g. 'date >= 30d', 'deviation outside -3 3'.\n";
+    
+    clearInputBuffer();
+    while (true) {
+        RunQuery query;
+        cout << "\nEnter filters, one per line (empty line to run, empty query to go back):\n";
+        string line;
+        while (getline(cin, line) && !line.empty()) {
+            RunPredicate predicate;
+            string error;
+            if (parseRunPredicate(line, runs, predicate, error)) {
+                query.filters.push_back(predicate);
+            } else {
+                cout << "Ignored: " << error << "\n";
+            }
+        }
+        if (query.filters.empty()) return;
+        
+        cout << "Aggregate column (default deviation): ";
+        getline(cin, line);
+        query.aggregate = COL_DEVIATION;
+        for (int c = 0; c < COL_DATE; c++) {
+            if (line == run_column_names[c]) query.aggregate = static_cast<RunColumn>(c);
+        }
+        cout << "Group by material? (y/n): ";
+        getline(cin, line);
+        query.group_by_material = !line.empty() && (line[0] == 'y' || line[0] == 'Y');
+        
+        start = chrono::steady_clock::now();
+        QueryResult result = runQuery(runs, query, max_rows);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        size_t matched = 0;
+        for (size_t g = 0; g < result.groups.size(); g++) matched += result.groups[g].count;
+        cout << "\n------ QUERY RESULTS ------\n";
+        cout << left << setw(20) << "Material" << right << setw(10) << "Runs" << setw(10) << "Valued" << setw(12) << "Mean"
+             << setw(12) << "Std dev" << setw(12) << "Min" << setw(12) << "Max" << "\n";
+        for (size_t g = 0; g < result.groups.size(); g++) {
+            const QueryGroup &group = result.groups[g];
+            if (group.count == 0 && query.group_by_material) continue;
+            double mean = group.valued ? group.sum / group.valued : 0;
+            double variance = group.valued ? max(0.0, group.sum_sq / group.valued - mean * mean) : 0;
+            cout << left << setw(20) << (query.group_by_material ? runs.materials[g] : string("All")) << right
+                 << setw(10) << group.count << setw(10) << group.valued << setprecision(3);
+            if (group.valued) {
+                cout << setw(12) << mean << setw(12) << sqrt(variance) << setw(12) << group.min << setw(12) << group.max;
+            } else {
+                cout << setw(12) << "-" << setw(12) << "-" << setw(12) << "-" << setw(12) << "-";
+            }
+            cout << "\n";
+        }
+        cout << "(aggregates over " << run_column_names[query.aggregate] << ")\n";
+        
+        if (!result.first_rows.empty()) {
+            cout << "\nFirst " << result.first_rows.size() << " matching runs:\n";
+            cout << left << setw(18) << "Date (UTC)" << setw(20) << "Material" << right << setw(10) << "Curie"
+                 << setw(10) << "Expected" << setw(10) << "Peak ε" << "\n";
+            for (size_t r = 0; r < result.first_rows.size(); r++) {
+                size_t i = result.first_rows[r];
+                char date[20];
+                time_t t = static_cast<time_t>(runs.timestamp[i]);
+                strftime(date, sizeof(date), "%Y-%m-%d %H:%M", gmtime(&t));
+                cout << left << setw(18) << date << setw(20) << runs.materials[runs.material_id[i]] << right
+                     << setprecision(2) << setw(10) << runs.curie_estimate[i] << setw(10) << runs.expected_curie[i]
+                     << setw(11) << runs.peak_epsilon[i] << "\n";
+            }
+        }
+        cout << setprecision(1) << "\nMatched " << matched << " of " << runs.size() << " runs in " << seconds * 1e3
+             << " ms (" << runs.size() / max(seconds, 1e-9) / 1e6 << " M runs/s)\n";
+    }
+}
+
+static RunRollup newRollup(int64_t day, const string &material) {
+    RunRollup rollup = {day, material, 0, 0, 0, numeric_limits<double>::infinity(), -numeric_limits<double>::infinity(),
+                        0, -numeric_limits<double>::infinity()};
+    return rollup;
+}
+
+static int64_t runDay(int64_t timestamp) {
+    return timestamp >= 0 ? timestamp / 86400 : (timestamp - 86399) / 86400;
+}
+
+void addToRollup(RunRollup &rollup, double curie_estimate, double peak_epsilon) {
+    rollup.runs++;
+    rollup.peak_epsilon_sum += peak_epsilon;
+    rollup.peak_epsilon_max = max(rollup.peak_epsilon_max, peak_epsilon);
+    if (curie_estimate != curie_estimate) return;
+    rollup.curie_runs++;
+    rollup.curie_sum += curie_estimate;
+    rollup.curie_min = min(rollup.curie_min, curie_estimate);
+    rollup.curie_max = max(rollup.curie_max, curie_estimate);
+}
+
+static void mergeRollup(RunRollup &to, const RunRollup &from) {
+    to.runs += from.runs;
+    to.curie_runs += from.curie_runs;
+    to.curie_sum += from.curie_sum;
+    to.curie_min = min(to.curie_min, from.curie_min);
+    to.curie_max = max(to.curie_max, from.curie_max);
+    to.peak_epsilon_sum += from.peak_epsilon_sum;
+    to.peak_epsilon_max = max(to.peak_epsilon_max, from.peak_epsilon_max);
+}
+
+// Tab-separated, one bucket per line, in the RunRollup field order
+bool loadRollups(RollupTable &rollups) {
+    ifstream file(rollup_file);
+    if (!file.is_open()) return false;
+    string line;
+    while (getline(file, line)) {
+        istringstream in(line);
+        long long day;
+        string material;
+        if (!(in >> day) || !getline(in.ignore(1), material, '\t')) continue;
+        RunRollup rollup = newRollup(day, material);
+        if (in >> rollup.runs >> rollup.curie_runs >> rollup.curie_sum >> rollup.curie_min >> rollup.curie_max
+               >> rollup.peak_epsilon_sum >> rollup.peak_epsilon_max) {
+            rollups[make_pair(rollup.day, material)] = rollup;
+        }
+    }
+    return true;
+}
+
+bool saveRollups(const RollupTable &rollups) {
+    ofstream file(rollup_file);
+    if (!file.is_open()) {
+        cout << "\nError: Could not write '" << rollup_file << "'.\n";
+        return false;
+    }
+    file << setprecision(17);
+    for (RollupTable::const_iterator it = rollups.begin(); it != rollups.end(); ++it) {
+        const RunRollup &r = it->second;
+        // Empty extremes are written as ±1e308 so the file reads back with >>
+        file << static_cast<long long>(r.day) << "\t" << r.material << "\t" << r.runs << "\t" << r.curie_runs << "\t"
+             << r.curie_sum << "\t" << min(r.curie_min, 1e308) << "\t" << max(r.curie_max, -1e308) << "\t"
+             << r.peak_epsilon_sum << "\t" << max(r.peak_epsilon_max, -1e308) << "\n";
+    }
+    return true;
+}
+
+// Adds newly stored runs to their day buckets
+void updateRollupsForRuns(const vector<RunRecord> &records) {
+    if (records.empty()) return;
+    RollupTable rollups;
+    loadRollups(rollups);
+    for (size_t i = 0; i < records.size(); i++) {
+        const RunRecord &r = records[i];
+        string material(r.material);
+        pair<int64_t, string> key(runDay(r.timestamp), material);
+        RollupTable::iterator it = rollups.find(key);
+        if (it == rollups.end()) it = rollups.insert(make_pair(key, newRollup(key.first, material))).first;
+        addToRollup(it->second, r.curie_estimate_C, r.peak_epsilon);
+    }
+    saveRollups(rollups);
+}
+
+// Appends analysed runs to the history files in the working directory and says where
+// they went, since the user never asked for them by name
+void storeRuns(const vector<RunRecord> &records) {
+    if (records.empty() || !appendRunRecords(records)) return;
+    updateSpcForRuns(records);
+    updateRollupsForRuns(records);
+    cout << "\n" << records.size() << (records.size() == 1 ? " run" : " runs") << " added to '" << run_store_file
+         << "', with control charts in '" << spc_state_file << "' and daily rollups in '" << rollup_file << "'.\n";
+}
+
+// Rebuilds every bucket from the run store. Each chunk of runs is bucketed by
+// (day, material id) on its own worker and the partial tables are merged.
+RollupTable rebuildRollups(const RunColumns &runs) {
+    const size_t chunk = 65536;
+    size_t num_chunks = (runs.size() + chunk - 1) / chunk;
+    typedef map<pair<int64_t, uint16_t>, RunRollup> PartialTable;
+    vector<PartialTable> partial(workerCount(num_chunks));
+    
+    parallelForWorkers(num_chunks, [&](unsigned worker, size_t c) {
+        PartialTable &table = partial[worker];
+        size_t end = min(runs.size(), (c + 1) * chunk);
+        PartialTable::iterator it = table.end();
+        for (size_t i = c * chunk; i < end; i++) {
+            pair<int64_t, uint16_t> key(runDay(runs.timestamp[i]), runs.material_id[i]);
+            if (it == table.end() || it->first != key) {
+                it = table.find(key);
+                if (it == table.end()) it = table.insert(make_pair(key, newRollup(key.first, runs.materials[key.second]))).first;
+            }
+            addToRollup(it->second, runs.curie_estimate[i], runs.peak_epsilon[i]);
+        }
+    });
+    
+    RollupTable rollups;
+    for (size_t w = 0; w < partial.size(); w++) {
+        for (PartialTable::iterator it = partial[w].begin(); it != partial[w].end(); ++it) {
+            pair<int64_t, string> key(it->first.first, it->second.material);
+            RollupTable::iterator found = rollups.find(key);
+            if (found == rollups.end()) {
+                rollups.insert(make_pair(key, it->second));
+            } else {
+                mergeRollup(found->second, it->second);
+            }
+        }
+    }
+    return rollups;
+}
+
+void showRollups() {
+    int choice, days;
+    cout << "1. Show daily summaries\n2. Rebuild summaries from the run store\nSelect (1-2): ";
+    while (!(cin >> choice) || choice < 1 || choice > 2) {
+        cout << "Invalid selection. Please enter 1 or 2: ";
+        clearInputBuffer();
+    }
+    
+    RollupTable rollups;
+    if (choice == 2) {
+        RunColumns runs;
+        if (!loadRunColumns(run_store_file, runs)) return;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        rollups = rebuildRollups(runs);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        saveRollups(rollups);
+        cout << fixed << setprecision(1) << "\nBucketed " << runs.size() << " runs into " << rollups.size()
+             << " day summaries in " << seconds * 1e3 << " ms.\n";
+    } else if (!loadRollups(rollups) || rollups.empty()) {
+        cout << "\nNo summaries yet. Store some runs or rebuild from the run store.\n";
+        return;
+    }
+    
+    cout << "Number of most recent days to show (1-366): ";
+    while (!(cin >> days) || days < 1 || days > 366) {
+        cout << "Invalid input. Please enter a number between 1 and 366: ";
+        clearInputBuffer();
+    }
+    
+    int64_t first_day = rollups.rbegin()->first.first - days + 1;
+    cout << "\n------ DAILY RUN SUMMARIES (UTC) ------\n";
+    cout << left << setw(12) << "Day" << setw(20) << "Material" << right << setw(8) << "Runs" << setw(11) << "Mean Tc"
+         << setw(10) << "Min Tc" << setw(10) << "Max Tc" << setw(13) << "Mean ε" << setw(12) << "Peak ε" << "\n";
+    for (RollupTable::const_iterator it = rollups.lower_bound(make_pair(first_day, string())); it != rollups.end(); ++it) {
+        const RunRollup &r = it->second;
+        char date[16];
+        time_t t = static_cast<time_t>(r.day * 86400);
+        strftime(date, sizeof(date), "%Y-%m-%d", gmtime(&t));
+        cout << left << setw(12) << date << setw(20) << r.material << right << setw(8) << r.runs << fixed << setprecision(2);
+        if (r.curie_runs > 0) {
+            cout << setw(11) << r.curie_sum / r.curie_runs << setw(10) << r.curie_min << setw(10) << r.curie_max;
+        } else {
+            cout << setw(11) << "-" << setw(10) << "-" << setw(10) << "-";
+        }
+        cout << setw(12) << r.peak_epsilon_sum / r.runs << setw(11) << r.peak_epsilon_max << "\n";
+    }
+}
+
+// Arrow IPC metadata is FlatBuffers. The builder below writes front to back: a table is
+// placed with zeroed offset fields, its children are appended after it (FlatBuffers
+// offsets only point forward) and fbLink patches the field to point at them.
+static void fbPad(vector<uint8_t> &fb, size_t alignment, size_t extra = 0) {
+    while ((fb.size() + extra) % alignment) fb.push_back(0);
+}
+
+template <typename T>
+static void fbPut(vector<uint8_t> &fb, size_t at, T value) {
+    memcpy(&fb[at], &value, sizeof(T));
+}
+
+template <typename T>
+static size_t fbAppend(vector<uint8_t> &fb, T value) {
+    size_t at = fb.size();
+    fb.resize(at + sizeof(T));
+    fbPut(fb, at, value);
+    return at;
+}
+
+static void fbLink(vector<uint8_t> &fb, size_t field, size_t target) {
+    fbPut<uint32_t>(fb, field, static_cast<uint32_t>(target - field));
+}
+
+// Writes a table whose fields have the given widths in bytes (0 = absent) and returns its
+// position; fields[i] is where field i's value goes. Fields are laid out widest first
+// after the vtable offset, and the table starts 4 bytes past an 8-byte boundary, so
+// every field is naturally aligned.
+static size_t fbTable(vector<uint8_t> &fb, const vector<int> &widths, vector<size_t> &fields) {
+    vector<uint16_t> offsets(widths.size(), 0);
+    uint16_t size = 4;
+    for (int width = 8; width >= 1; width /= 2) {
+        for (size_t f = 0; f < widths.size(); f++) {
+            if (widths[f] != width) continue;
+            offsets[f] = size;
+            size += width;
+        }
+    }
+    fbPad(fb, 2);
+    size_t vtable = fb.size();
+    fbAppend<uint16_t>(fb, static_cast<uint16_t>(4 + 2 * widths.size()));
+    fbAppend<uint16_t>(fb, size);
+    for (size_t f = 0; f < offsets.size(); f++) fbAppend<uint16_t>(fb, offsets[f]);
+    
+    fbPad(fb, 8, 4);
+    size_t table = fb.size();
+    fb.resize(table + size, 0);
+    fbPut<int32_t>(fb, table, static_cast<int32_t>(table - vtable));
+    fields.assign(widths.size(), 0);
+    for (size_t f = 0; f < widths.size(); f++) {
+        if (widths[f]) fields[f] = table + offsets[f];
+    }
+    return table;
+}
+
+static size_t fbString(vector<uint8_t> &fb, const string &text) {
+    fbPad(fb, 4);
+    size_t at = fbAppend<uint32_t>(fb, static_cast<uint32_t>(text.size()));
+    fb.insert(fb.end(), text.begin(), text.end());
+    fb.push_back(0);
+    return at;
+}
+
+// Vector of count table offsets; element i is at the returned position + 4 + 4i
+static size_t fbOffsetVector(vector<uint8_t> &fb, size_t count) {
+    fbPad(fb, 4);
+    size_t at = fbAppend<uint32_t>(fb, static_cast<uint32_t>(count));
+    fb.resize(fb.size() + 4 * count, 0);
+    return at;
+}
+
+// Vector of count 8-byte-aligned structs of struct_size bytes each
+static size_t fbStructVector(vector<uint8_t> &fb, const void *data, size_t count, size_t struct_size) {
+    fbPad(fb, 8, 4);
+    size_t at = fbAppend<uint32_t>(fb, static_cast<uint32_t>(count));
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    fb.insert(fb.end(), bytes, bytes + count * struct_size);
+    return at;
+}
+
+// Arrow Schema table (Schema.fbs): fields with their types, no children or dictionaries
+static size_t fbArrowSchema(vector<uint8_t> &fb, const vector<ArrowColumn> &columns) {
+    enum { TYPE_INT = 2, TYPE_FLOATING_POINT = 3, TYPE_UTF8 = 5, TYPE_TIMESTAMP = 10 };
+    vector<size_t> schema_fields, field_fields, type_fields;
+    size_t schema = fbTable(fb, {2, 4}, schema_fields);   // endianness, fields
+    fbPut<int16_t>(fb, schema_fields[0], 0);              // little-endian
+    size_t field_vector = fbOffsetVector(fb, columns.size());
+    fbLink(fb, schema_fields[1], field_vector);
+    
+    for (size_t c = 0; c < columns.size(); c++) {
+        // name, nullable, type_type, type, dictionary, children
+        size_t field = fbTable(fb, {4, 1, 1, 4, 0, 4}, field_fields);
+        fbLink(fb, field_vector + 4 + 4 * c, field);
+        fbLink(fb, field_fields[0], fbString(fb, columns[c].name));
+        size_t type;
+        switch (columns[c].type) {
+            case ARROW_INT32:
+                type = fbTable(fb, {4, 1}, type_fields);    // bitWidth, is_signed
+                fbPut<int32_t>(fb, type_fields[0], 32);
+                fbPut<uint8_t>(fb, type_fields[1], 1);
+                fbPut<uint8_t>(fb, field_fields[2], TYPE_INT);
+                break;
+            case ARROW_FLOAT32:
+            case ARROW_FLOAT64:
+                type = fbTable(fb, {2}, type_fields);       // precision: SINGLE = 1, DOUBLE = 2
+                fbPut<int16_t>(fb, type_fields[0], columns[c].type == ARROW_FLOAT32 ? 1 : 2);
+                fbPut<uint8_t>(fb, field_fields[2], TYPE_FLOATING_POINT);
+                break;
+            case ARROW_TIMESTAMP:
+                type = fbTable(fb, {2, 4}, type_fields);    // unit (SECOND = 0), timezone
+                fbPut<int16_t>(fb, type_fields[0], 0);
+                fbLink(fb, type_fields[1], fbString(fb, "UTC"));
+                fbPut<uint8_t>(fb, field_fields[2], TYPE_TIMESTAMP);
+                break;
+            default:
+                type = fbTable(fb, {}, type_fields);
+                fbPut<uint8_t>(fb, field_fields[2], TYPE_UTF8);
+                break;
+        }
+        fbLink(fb, field_fields[3], type);
+        fbLink(fb, field_fields[5], fbOffsetVector(fb, 0));
+    }
+    return schema;
+}
+
+// Encapsulated IPC message: continuation marker, metadata length, the Message
+// flatbuffer padded to 8 bytes, then the body. Returns the metadata length with prefix.
+static int32_t writeArrowMessage(ofstream &out, const vector<uint8_t> &fb, const vector<uint8_t> &body) {
+    size_t padded = (fb.size() + 7) / 8 * 8;
+    uint32_t header[2] = {0xFFFFFFFFu, static_cast<uint32_t>(padded)};
+    const char zeros[8] = {0};
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(&fb[0]), fb.size());
+    out.write(zeros, padded - fb.size());
+    if (!body.empty()) out.write(reinterpret_cast<const char *>(&body[0]), body.size());
+    return static_cast<int32_t>(padded + 8);
+}
+
+// Message table (Message.fbs) wrapping a Schema (1) or RecordBatch (3) header
+static size_t fbArrowMessage(vector<uint8_t> &fb, uint8_t header_type, int64_t body_length, size_t &header_field) {
+    vector<size_t> fields;
+    fbAppend<uint32_t>(fb, 0);                              // root offset
+    size_t message = fbTable(fb, {2, 1, 4, 8}, fields);     // version, header_type, header, bodyLength
+    fbLink(fb, 0, message);
+    fbPut<int16_t>(fb, fields[0], 4);                       // MetadataVersion V5
+    fbPut<uint8_t>(fb, fields[1], header_type);
+    fbPut<int64_t>(fb, fields[3], body_length);
+    header_field = fields[2];
+    return message;
+}
+
+// Writes columns as an Arrow IPC stream, or as an Arrow IPC file (magic, stream, footer)
+// when file_format is set, in record batches of up to batch_rows rows. Each buffer in a
+// batch body starts on a 64-byte boundary.
+bool writeArrowIpc(const string &filename, const vector<ArrowColumn> &columns, size_t num_rows, size_t batch_rows, bool file_format) {
+    struct ArrowBlock { int64_t offset; int32_t metadata_length; int32_t padding; int64_t body_length; };
+    struct ArrowBuffer { int64_t offset, length; };
+    struct ArrowFieldNode { int64_t length, null_count; };
+    
+    ofstream out(filename.c_str(), ios::binary);
+    if (!out.is_open()) {
+        cout << "\nError: Could not create '" << filename << "'.\n";
+        return false;
+    }
+    if (file_format) out.write("ARROW1\0\0", 8);
+    
+    vector<uint8_t> fb, body;
+    size_t header_field;
+    fbArrowMessage(fb, 1, 0, header_field);
+    fbLink(fb, header_field, fbArrowSchema(fb, columns));
+    writeArrowMessage(out, fb, body);
+    
+    vector<ArrowBlock> blocks;
+    vector<int32_t> rebased;
+    batch_rows = max<size_t>(batch_rows, 1);
+    for (size_t begin = 0; begin == 0 || begin < num_rows; begin += batch_rows) {
+        size_t rows = min(batch_rows, num_rows - begin);
+        vector<ArrowFieldNode> nodes;
+        vector<ArrowBuffer> buffers;
+        body.clear();
+        for (size_t c = 0; c < columns.size(); c++) {
+            const ArrowColumn &column = columns[c];
+            ArrowFieldNode node = {static_cast<int64_t>(rows), 0};
+            nodes.push_back(node);
+            ArrowBuffer validity = {static_cast<int64_t>(body.size()), 0}; // no nulls, no bitmap
+            buffers.push_back(validity);
+            
+            const uint8_t *data = static_cast<const uint8_t *>(column.values);
+            size_t bytes;
+            if (column.type == ARROW_UTF8) {
+                rebased.resize(rows + 1);
+                for (size_t r = 0; r <= rows; r++) rebased[r] = column.offsets[begin + r] - column.offsets[begin];
+                ArrowBuffer offsets = {static_cast<int64_t>(body.size()), static_cast<int64_t>(4 * (rows + 1))};
+                buffers.push_back(offsets);
+                const uint8_t *offset_bytes = reinterpret_cast<const uint8_t *>(&rebased[0]);
+                body.insert(body.end(), offset_bytes, offset_bytes + offsets.length);
+                while (body.size() % 64) body.push_back(0);
+                data += column.offsets[begin];
+                bytes = rebased[rows];
+            } else {
+                size_t width = column.type == ARROW_INT32 || column.type == ARROW_FLOAT32 ? 4 : 8;
+                data += begin * width;
+                bytes = rows * width;
+            }
+            ArrowBuffer values = {static_cast<int64_t>(body.size()), static_cast<int64_t>(bytes)};
+            buffers.push_back(values);
+            body.insert(body.end(), data, data + bytes);
+            while (body.size() % 64) body.push_back(0);
+        }
+        
+        fb.clear();
+        fbArrowMessage(fb, 3, static_cast<int64_t>(body.size()), header_field);
+        vector<size_t> fields;
+        size_t batch = fbTable(fb, {8, 4, 4}, fields);      // length, nodes, buffers
+        fbLink(fb, header_field, batch);
+        fbPut<int64_t>(fb, fields[0], static_cast<int64_t>(rows));
+        fbLink(fb, fields[1], fbStructVector(fb, &nodes[0], nodes.size(), sizeof(ArrowFieldNode)));
+        fbLink(fb, fields[2], fbStructVector(fb, &buffers[0], buffers.size(), sizeof(ArrowBuffer)));
+        
+        ArrowBlock block = {static_cast<int64_t>(out.tellp()), 0, 0, static_cast<int64_t>(body.size())};
+        block.metadata_length = writeArrowMessage(out, fb, body);
+        blocks.push_back(block);
+    }
+    
+    uint32_t end_of_stream[2] = {0xFFFFFFFFu, 0};
+    out.write(reinterpret_cast<const char *>(end_of_stream), sizeof(end_of_stream));
+    
+    if (file_format) {
+        // Footer (File.fbs): version, schema, dictionaries, recordBatches
+        fb.clear();
+        vector<size_t> fields;
+        fbAppend<uint32_t>(fb, 0);
+        size_t footer = fbTable(fb, {2, 4, 4, 4}, fields);
+        fbLink(fb, 0, footer);
+        fbPut<int16_t>(fb, fields[0], 4);
+        fbLink(fb, fields[1], fbArrowSchema(fb, columns));
+        fbLink(fb, fields[2], fbStructVector(fb, 0, 0, sizeof(ArrowBlock)));
+        fbLink(fb, fields[3], fbStructVector(fb, &blocks[0], blocks.size(), sizeof(ArrowBlock)));
+        fbPad(fb, 8);
+        int32_t footer_length = static_cast<int32_t>(fb.size());
+        out.write(reinterpret_cast<const char *>(&fb[0]), fb.size());
+        out.write(reinterpret_cast<const char *>(&footer_length), sizeof(footer_length));
+        out.write("ARROW1", 6);
+    }
+    return static_cast<bool>(out);
+}
+
+// Bounds-checked access to a FlatBuffers table; any read outside the buffer clears ok
+struct FlatBufferView {
+    const uint8_t *data;
+    size_t size;
+    bool ok;
+    
+    template <typename T>
+    T read(size_t at) {
+        T value = 0;
+        if (at > size || size - at < sizeof(T)) {
+            ok = false;
+        } else {
+            memcpy(&value, data + at, sizeof(T));
+        }
+        return value;
+    }
+    
+    // Position of field id in the table, or 0 when absent
+    size_t field(size_t table, int id) {
+        int64_t vtable = static_cast<int64_t>(table) - read<int32_t>(table);
+        if (vtable < 0 || !ok) {
+            ok = false;
+            return 0;
+        }
+        uint16_t vtable_size = read<uint16_t>(static_cast<size_t>(vtable));
+        if (4 + 2 * id >= vtable_size) return 0;
+        uint16_t offset = read<uint16_t>(static_cast<size_t>(vtable) + 4 + 2 * id);
+        return offset ? table + offset : 0;
+    }
+    
+    template <typename T>
+    T scalar(size_t table, int id, T fallback) {
+        size_t at = field(table, id);
+        return at ? read<T>(at) : fallback;
+    }
+    
+    // Position of the table, string or vector an offset field points to, or 0 when absent
+    size_t target(size_t table, int id) {
+        size_t at = field(table, id);
+        return at ? at + read<uint32_t>(at) : 0;
+    }
+    
+    string text(size_t at) {
+        uint32_t length = read<uint32_t>(at);
+        if (!ok || length > size - at - 4) {
+            ok = false;
+            return string();
+        }
+        return string(reinterpret_cast<const char *>(data + at + 4), length);
+    }
+};
+
+static bool parseArrowSchema(FlatBufferView &fb, size_t schema, vector<ArrowColumn> &columns, string &error) {
+    size_t fields = fb.target(schema, 1);
+    uint32_t count = fields ? fb.read<uint32_t>(fields) : 0;
+    for (uint32_t c = 0; c < count && fb.ok; c++) {
+        size_t slot = fields + 4 + 4 * c;
+        size_t field = slot + fb.read<uint32_t>(slot);
+        ArrowColumn column;
+        size_t name = fb.target(field, 0);
+        column.name = name ? fb.text(name) : string();
+        column.values = 0;
+        column.offsets = 0;
+        if (fb.field(field, 4)) {
+            error = "column '" + column.name + "' is dictionary-encoded, which is not supported";
+            return false;
+        }
+        size_t type = fb.target(field, 3);
+        uint8_t type_type = fb.scalar<uint8_t>(field, 2, 0);
+        if (type_type == 2 && fb.scalar<int32_t>(type, 0, 0) == 32 && fb.scalar<uint8_t>(type, 1, 0)) {
+            column.type = ARROW_INT32;
+        } else if (type_type == 3 && fb.scalar<int16_t>(type, 0, 0) == 1) {
+            column.type = ARROW_FLOAT32;
+        } else if (type_type == 3 && fb.scalar<int16_t>(type, 0, 0) == 2) {
+            column.type = ARROW_FLOAT64;
+        } else if (type_type == 10 && fb.scalar<int16_t>(type, 0, 0) == 0) {
+            column.type = ARROW_TIMESTAMP;
+        } else if (type_type == 5) {
+            column.type = ARROW_UTF8;
+        } else {
+            error = "column '" + column.name + "' has an unsupported type";
+            return false;
+        }
+        columns.push_back(column);
+    }
+    if (!fb.ok) error = "corrupt schema";
+    return fb.ok;
+}
+
+// Reads an Arrow IPC file or stream written with int32, float, double, second
+// timestamp and UTF-8 columns without nulls. The file is walked as a stream (a file is
+// a stream between its magic and its footer); columns are left in the mapping.
+bool readArrowIpc(const string &filename, ArrowFile &file, string &error) {
+    file.release();
+#ifdef MMAP_SUPPORTED
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            void *mapping = mmap(0, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                file.mapping = mapping;
+                file.bytes = static_cast<const uint8_t *>(mapping);
+                file.size = static_cast<size_t>(info.st_size);
+            }
+        }
+        close(fd);
+    }
+#endif
+    if (!file.mapping) {
+        ifstream in(filename.c_str(), ios::binary);
+        if (!in.is_open()) {
+            error = "could not open '" + filename + "'";
+            return false;
+        }
+        string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());  // pipes cannot seek
+        file.size = contents.size();
+        file.storage.assign((file.size + 7) / 8, 0);
+        if (file.size > 0) memcpy(file.storage.data(), contents.data(), file.size);
+        file.bytes = reinterpret_cast<const uint8_t *>(file.storage.data());
+    }
+    const uint8_t *bytes = file.bytes;
+    size_t size = file.size;
+    
+    size_t pos = size >= 8 && memcmp(bytes, "ARROW1", 6) == 0 ? 8 : 0;
+    while (pos + 8 <= size) {
+        uint32_t metadata_length, prefix = 8;
+        memcpy(&metadata_length, bytes + pos, 4);
+        if (metadata_length == 0xFFFFFFFFu) {
+            memcpy(&metadata_length, bytes + pos + 4, 4);
+        } else {
+            prefix = 4;     // pre-1.0 messages have no continuation marker
+        }
+        if (metadata_length == 0) break;    // end of stream
+        
+        FlatBufferView fb = {bytes + pos + prefix, min<size_t>(metadata_length, size - pos - prefix), true};
+        size_t message = fb.read<uint32_t>(0);
+        uint8_t header_type = fb.scalar<uint8_t>(message, 1, 0);
+        size_t header = fb.target(message, 2);
+        int64_t body_length = fb.scalar<int64_t>(message, 3, 0);
+        size_t body = pos + prefix + metadata_length;
+        if (!fb.ok || header == 0 || body_length < 0 || body > size ||
+            static_cast<uint64_t>(body_length) > size - body) {
+            error = "truncated or corrupt message";
+            return false;
+        }
+        
+        if (header_type == 1) {
+            if (!parseArrowSchema(fb, header, file.schema, error)) return false;
+        } else if (header_type == 3) {
+            if (fb.field(header, 3)) {
+                error = "compressed record batches are not supported";
+                return false;
+            }
+            int64_t row_count = fb.scalar<int64_t>(header, 0, 0);
+            if (row_count < 0) {
+                error = "negative row count";
+                return false;
+            }
+            size_t rows = static_cast<size_t>(row_count);
+            size_t nodes = fb.target(header, 1), buffers = fb.target(header, 2);
+            uint32_t num_nodes = nodes ? fb.read<uint32_t>(nodes) : 0;
+            uint32_t num_buffers = buffers ? fb.read<uint32_t>(buffers) : 0;
+            vector<ArrowColumn> batch = file.schema;
+            uint32_t buffer = 0;
+            for (size_t c = 0; c < batch.size(); c++) {
+                ArrowColumn &column = batch[c];
+                if (c >= num_nodes || fb.read<int64_t>(nodes + 4 + 16 * c + 8) != 0) {
+                    error = "column '" + column.name + "' is missing or has nulls";
+                    return false;
+                }
+                buffer++;   // validity bitmap, unused without nulls
+                int num_data = column.type == ARROW_UTF8 ? 2 : 1;
+                const uint8_t *data[2] = {0, 0};
+                int64_t lengths[2] = {0, 0};
+                for (int d = 0; d < num_data; d++, buffer++) {
+                    int64_t offset = fb.read<int64_t>(buffers + 4 + 16 * buffer);
+                    lengths[d] = fb.read<int64_t>(buffers + 4 + 16 * buffer + 8);
+                    if (buffer >= num_buffers || offset < 0 || lengths[d] < 0 || offset > body_length ||
+                        lengths[d] > body_length - offset || (body + offset) % 8) {
+                        error = "bad buffer for column '" + column.name + "'";
+                        return false;
+                    }
+                    data[d] = bytes + body + offset;
+                }
+                
+                // Buffers must hold every row before the columns are handed out. Sizes are
+                // compared by dividing, since rows comes from the file and may be huge.
+                bool complete;
+                if (column.type == ARROW_UTF8) {
+                    column.offsets = reinterpret_cast<const int32_t *>(data[0]);
+                    column.values = data[1];
+                    complete = row_count < lengths[0] / 4;
+                    for (size_t r = 0; r < rows && complete; r++) {
+                        complete = column.offsets[r] >= 0 && column.offsets[r] <= column.offsets[r + 1];
+                    }
+                    complete = complete && column.offsets[rows] <= lengths[1];
+                } else {
+                    column.values = data[0];
+                    size_t width = column.type == ARROW_INT32 || column.type == ARROW_FLOAT32 ? 4 : 8;
+                    complete = row_count <= lengths[0] / static_cast<int64_t>(width);
+                }
+                if (!complete) {
+                    error = "column '" + column.name + "' is shorter than its record batch";
+                    return false;
+                }
+            }
+            if (!fb.ok) {
+                error = "corrupt record batch";
+                return false;
+            }
+            file.batch_rows.push_back(rows);
+            file.batches.push_back(batch);
+        }
+        pos = body + static_cast<size_t>(body_length);
+    }
+    if (file.schema.empty()) {
+        error = "no schema found";
+        return false;
+    }
+    return true;
+}
+
+// Concatenates strings into one Arrow UTF-8 column buffer with offsets
+static void packArrowStrings(const vector<string> &strings, string &bytes, vector<int32_t> &offsets) {
+    offsets.assign(1, 0);
+    for (size_t i = 0; i < strings.size(); i++) {
+        bytes += strings[i];
+        offsets.push_back(static_cast<int32_t>(bytes.size()));
+    }
+}
+
+static string arrowValue(const ArrowColumn &column, size_t row) {
+    ostringstream out;
+    out << fixed << setprecision(3);
+    switch (column.type) {
+        case ARROW_INT32: out << static_cast<const int32_t *>(column.values)[row]; break;
+        case ARROW_FLOAT32: out << static_cast<const float *>(column.values)[row]; break;
+        case ARROW_FLOAT64: out << static_cast<const double *>(column.values)[row]; break;
+        case ARROW_TIMESTAMP: {
+            char date[24];
+            time_t t = static_cast<time_t>(static_cast<const int64_t *>(column.values)[row]);
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", gmtime(&t));
+            out << date;
+            break;
+        }
+        default: {
+            const char *text = static_cast<const char *>(column.values);
+            out << string(text + column.offsets[row], text + column.offsets[row + 1]);
+            break;
+        }
+    }
+    return out.str();
+}
+
+void arrowTools() {
+    const size_t batch_rows = 1 << 20;
+    int choice, format = 1;
+    cout << "1. Export plate run readings and results (from file)\n2. Export the run store\n"
+            "3. Inspect an Arrow IPC file\n4. Save simulation readings as Arrow too (now "
+         << (save_arrow_readings ? "on" : "off") << ")\nSelect (1-4): ";
+    while (!(cin >> choice) || choice < 1 || choice > 4) {
+        cout << "Invalid selection. Please enter a number between 1 and 4: ";
+        clearInputBuffer();
+    }
+    if (choice == 4) {
+        save_arrow_readings = !save_arrow_readings;
+        cout << "\nSimulation readings " << (save_arrow_readings ? "will also" : "will no longer")
+             << " be saved to <material>_results.arrow.\n";
+        return;
+    }
+    if (choice < 3) {
+        cout << "1. Arrow IPC file (.arrow)\n2. Arrow IPC stream (.arrows)\nSelect a format (1-2): ";
+        while (!(cin >> format) || format < 1 || format > 2) {
+            cout << "Invalid selection. Please enter 1 or 2: ";
+            clearInputBuffer();
+        }
+    }
+    bool file_format = format == 1;
+    string extension = file_format ? ".arrow" : ".arrows";
+    
+    if (choice == 1) {
+        string filename;
+        cout << "Plate run file: ";
+        clearInputBuffer();
+        getline(cin, filename);
+        MultiplexedRun run;
+        if (!loadMultiplexedRun(filename, run)) return;
+        map<int, Sample> demuxed = demultiplexRun(run);
+        vector<Sample> samples;
+        vector<int32_t> channels;
+        for (map<int, Sample>::iterator it = demuxed.begin(); it != demuxed.end(); ++it) {
+            channels.push_back(it->first);
+            samples.push_back(it->second);
+        }
+        vector<RunResult> results = analyzeSamplesConcurrently(samples);
+        
+        // Readings, one row per reading, grouped by channel
+        vector<int32_t> reading_channel, temperature;
+        vector<double> capacitance, epsilon;
+        vector<string> reading_material;
+        for (size_t s = 0; s < samples.size(); s++) {
+            for (size_t i = 0; i < samples[s].temp_capacitance_data.size(); i++) {
+                reading_channel.push_back(channels[s]);
+                reading_material.push_back(samples[s].name);
+                temperature.push_back(samples[s].temp_capacitance_data[i].first);
+                capacitance.push_back(samples[s].temp_capacitance_data[i].second);
+                epsilon.push_back(samples[s].temp_capacitance_data[i].second / results[s].C0);
+            }
+        }
+        string material_bytes;
+        vector<int32_t> material_offsets;
+        packArrowStrings(reading_material, material_bytes, material_offsets);
+        const ArrowColumn readings[] = {
+            {"channel", ARROW_INT32, reading_channel.data(), 0},
+            {"material", ARROW_UTF8, material_bytes.data(), material_offsets.data()},
+            {"temperature_C", ARROW_INT32, temperature.data(), 0},
+            {"capacitance_pF", ARROW_FLOAT64, capacitance.data(), 0},
+            {"epsilon_r", ARROW_FLOAT64, epsilon.data(), 0},
+        };
+        
+        // Results, one row per channel
+        const double nan = numeric_limits<double>::quiet_NaN();
+        vector<int32_t> num_readings, peak_temp;
+        vector<double> C0, peak_epsilon, curie, uncertainty, T0, curie_constant;
+        vector<string> names;
+        for (size_t s = 0; s < results.size(); s++) {
+            const RunResult &r = results[s];
+            bool fitted = samples[s].curie_temp_C > 0 && r.prediction.peak_passed;
+            names.push_back(r.name);
+            num_readings.push_back(static_cast<int32_t>(r.num_readings));
+            C0.push_back(r.C0);
+            peak_epsilon.push_back(r.peak_epsilon);
+            peak_temp.push_back(r.peak_temp);
+            curie.push_back(fitted ? r.prediction.predicted_curie_C : nan);
+            uncertainty.push_back(fitted ? r.prediction.uncertainty_C : nan);
+            T0.push_back(fitted ? r.prediction.curie_weiss_T0_C : nan);
+            curie_constant.push_back(fitted ? r.prediction.curie_constant : nan);
+        }
+        string name_bytes;
+        vector<int32_t> name_offsets;
+        packArrowStrings(names, name_bytes, name_offsets);
+        const ArrowColumn result_columns[] = {
+            {"channel", ARROW_INT32, channels.data(), 0},
+            {"material", ARROW_UTF8, name_bytes.data(), name_offsets.data()},
+            {"num_readings", ARROW_INT32, num_readings.data(), 0},
+            {"C0_pF", ARROW_FLOAT64, C0.data(), 0},
+            {"peak_epsilon", ARROW_FLOAT64, peak_epsilon.data(), 0},
+            {"peak_temperature_C", ARROW_INT32, peak_temp.data(), 0},
+            {"curie_C", ARROW_FLOAT64, curie.data(), 0},
+            {"curie_uncertainty_C", ARROW_FLOAT64, uncertainty.data(), 0},
+            {"curie_weiss_T0_C", ARROW_FLOAT64, T0.data(), 0},
+            {"curie_constant_K", ARROW_FLOAT64, curie_constant.data(), 0},
+        };
+        
+        string base = filename.substr(0, filename.find_last_of('.'));
+        string readings_file = base + "_readings" + extension, results_file = base + "_results" + extension;
+        if (writeArrowIpc(readings_file, vector<ArrowColumn>(readings, readings + 5), temperature.size(), batch_rows, file_format) &&
+            writeArrowIpc(results_file, vector<ArrowColumn>(result_columns, result_columns + 10), results.size(), batch_rows, file_format)) {
+            cout << "\nWrote " << temperature.size() << " readings to '" << readings_file << "' and " << results.size()
+                 << " results to '" << results_file << "'.\n";
+        }
+    } else if (choice == 2) {
+        RunColumns runs;
+        if (!loadRunColumns(run_store_file, runs)) return;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<int32_t> dictionary_offsets;
+        string dictionary_bytes, material_bytes;
+        packArrowStrings(runs.materials, dictionary_bytes, dictionary_offsets);
+        vector<int32_t> material_offsets(1, 0);
+        material_offsets.reserve(runs.size() + 1);
+        for (size_t i = 0; i < runs.size(); i++) {
+            uint16_t m = runs.material_id[i];
+            material_bytes.append(dictionary_bytes, dictionary_offsets[m], dictionary_offsets[m + 1] - dictionary_offsets[m]);
+            material_offsets.push_back(static_cast<int32_t>(material_bytes.size()));
+        }
+        const ArrowColumn columns[] = {
+            {"timestamp", ARROW_TIMESTAMP, runs.timestamp.data(), 0},
+            {"material", ARROW_UTF8, material_bytes.data(), material_offsets.data()},
+            {"curie_estimate_C", ARROW_FLOAT32, runs.curie_estimate.data(), 0},
+            {"expected_curie_C", ARROW_FLOAT32, runs.expected_curie.data(), 0},
+            {"peak_epsilon", ARROW_FLOAT32, runs.peak_epsilon.data(), 0},
+            {"curie_weiss_T0_C", ARROW_FLOAT32, runs.curie_weiss_T0.data(), 0},
+            {"curie_constant_K", ARROW_FLOAT32, runs.curie_constant.data(), 0},
+            {"num_readings", ARROW_INT32, runs.num_readings.data(), 0},
+        };
+        string output = string("run_store") + extension;
+        if (writeArrowIpc(output, vector<ArrowColumn>(columns, columns + 8), runs.size(), batch_rows, file_format)) {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << fixed << setprecision(1) << "\nWrote " << runs.size() << " runs to '" << output << "' in "
+                 << seconds * 1e3 << " ms.\n";
+        }
+    } else {
+        string filename, error;
+        cout << "Arrow IPC file: ";
+        clearInputBuffer();
+        getline(cin, filename);
+        ArrowFile file;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!readArrowIpc(filename, file, error)) {
+            cout << "\nError: " << error << ".\n";
+            return;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        size_t total = 0;
+        for (size_t b = 0; b < file.batch_rows.size(); b++) total += file.batch_rows[b];
+        
+        const char *type_names[] = {"int32", "float32", "float64", "timestamp[s, UTC]", "utf8"};
+        cout << "\n------ ARROW SCHEMA ------\n";
+        for (size_t c = 0; c < file.schema.size(); c++) {
+            cout << left << setw(24) << file.schema[c].name << type_names[file.schema[c].type] << "\n";
+        }
+        cout << right << "\n" << total << " rows in " << file.batches.size() << " record batch(es), read in "
+             << fixed << setprecision(1) << seconds * 1e3 << " ms.\n";
+        if (file.batches.empty()) return;
+        
+        size_t shown = min<size_t>(file.batch_rows[0], 10);
+        cout << "\nFirst " << shown << " rows:\n";
+        for (size_t c = 0; c < file.schema.size(); c++) cout << setw(20) << file.schema[c].name.substr(0, 19);
+        cout << "\n";
+        for (size_t r = 0; r < shown; r++) {
+            for (size_t c = 0; c < file.schema.size(); c++) cout << setw(20) << arrowValue(file.batches[0][c], r).substr(0, 19);
+            cout << "\n";
+        }
+    }
+}
+
+// C ABI (material_identifier.h). Each context carries its own sample, classifier and
+// scratch space, and the library keeps no other mutable state, so contexts on different
+// threads never contend.
+struct mi_context {
+    mutable mutex lock;
+    Sample sample;
+    CompiledForest forest;
+    char error[128];
+    double features[256 * NUM_CARRIER_FEATURES];  // classification scratch, one block of samples
+};
+
+static mi_status failWith(mi_context *context, mi_status status, const char *message) {
+    strncpy(context->error, message, sizeof(context->error) - 1);
+    context->error[sizeof(context->error) - 1] = '\0';
+    return status;
+}
+
+extern "C" unsigned mi_abi_version(void) {
+    return MI_ABI_VERSION;
+}
+
+extern "C" mi_context *mi_context_create(void) {
+    mi_context *context = new (nothrow) mi_context;
+    if (!context) return 0;
+    context->sample.name = "";
+    context->sample.area_mm2 = 8 * 6;
+    context->sample.thickness_mm = 1.42;
+    context->sample.curie_temp_C = -1;
+    context->forest = activeMaterialForest();
+    context->error[0] = '\0';
+    return context;
+}
+
+extern "C" void mi_context_destroy(mi_context *context) {
+    delete context;
+}
+
+// Copied out under the lock, so another thread's failing call on the same context
+// cannot rewrite the text while the caller reads it
+extern "C" const char *mi_last_error(const mi_context *context) {
+    if (!context) return "no context";
+    thread_local char message[sizeof(context->error)];
+    lock_guard<mutex> guard(context->lock);
+    memcpy(message, context->error, sizeof(message));
+    return message;
+}
+
+extern "C" mi_status mi_set_sample(mi_context *context, const char *material, double area_mm2, double thickness_mm) {
+    if (!context) return MI_INVALID_ARGUMENT;
+    lock_guard<mutex> guard(context->lock);
+    if (!(area_mm2 > 0) || !(thickness_mm > 0)) return failWith(context, MI_INVALID_ARGUMENT, "area and thickness must be positive");
+    double curie_temp_C = -1;
+    if (material && !findCurieTemperature(material, curie_temp_C)) {
+        return failWith(context, MI_UNKNOWN_MATERIAL, "material not in the database");
+    }
+    // The name is not kept: nothing in the library reads it, and copying it could allocate
+    context->sample.area_mm2 = area_mm2;
+    context->sample.thickness_mm = thickness_mm;
+    context->sample.curie_temp_C = curie_temp_C;
+    return MI_OK;
+}
+
+// Insertion sort: a sweep arrives almost in temperature order, so this is close to
+// linear and needs no scratch memory
+extern "C" mi_status mi_ingest_readings(mi_context *context, int *temperature_C, double *capacitance_pF, size_t *count) {
+    if (!context) return MI_INVALID_ARGUMENT;
+    lock_guard<mutex> guard(context->lock);
+    if (!count || (*count > 0 && (!temperature_C || !capacitance_pF))) {
+        return failWith(context, MI_INVALID_ARGUMENT, "null reading array");
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < *count; i++) {
+        if (temperature_C[i] < -273 || !(capacitance_pF[i] > 0)) continue;
+        int temp = temperature_C[i];
+        double capacitance = capacitance_pF[i];
+        size_t j = kept++;
+        for (; j > 0 && temperature_C[j - 1] > temp; j--) {
+            temperature_C[j] = temperature_C[j - 1];
+            capacitance_pF[j] = capacitance_pF[j - 1];
+        }
+        temperature_C[j] = temp;
+        capacitance_pF[j] = capacitance;
+    }
+    *count = kept;
+    return MI_OK;
+}
+
+extern "C" mi_status mi_demultiplex_channel(mi_context *context, const int *channel, const int *temperature_C,
+                                            const double *capacitance_pF, size_t count, int wanted_channel,
+                                            int *out_temperature_C, double *out_capacitance_pF, size_t capacity,
+                                            size_t *out_count) {
+    if (!context) return MI_INVALID_ARGUMENT;
+    lock_guard<mutex> guard(context->lock);
+    if (!out_count || (count > 0 && (!channel || !temperature_C || !capacitance_pF)) ||
+        (capacity > 0 && (!out_temperature_C || !out_capacitance_pF))) {
+        return failWith(context, MI_INVALID_ARGUMENT, "null array");
+    }
+    size_t found = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (channel[i] != wanted_channel) continue;
+        if (found < capacity) {
+            out_temperature_C[found] = temperature_C[i];
+            out_capacitance_pF[found] = capacitance_pF[i];
+        }
+        found++;
+    }
+    *out_count = min(found, capacity);
+    return found > capacity ? failWith(context, MI_BUFFER_TOO_SMALL, "more readings than capacity") : MI_OK;
+}
+
+extern "C" mi_status mi_epsilon(mi_context *context, const double *capacitance_pF, size_t count, double *epsilon) {
+    if (!context) return MI_INVALID_ARGUMENT;
+    lock_guard<mutex> guard(context->lock);
+    if (count > 0 && (!capacitance_pF || !epsilon)) return failWith(context, MI_INVALID_ARGUMENT, "null array");
+    double inverse_C0 = 1.0 / vacuumCapacitance(context->sample);
+    for (size_t i = 0; i < count; i++) epsilon[i] = capacitance_pF[i] * inverse_C0;
+    return MI_OK;
+}
+
+extern "C" mi_status mi_analyze_curie(mi_context *context, const int *temperature_C, const double *capacitance_pF, size_t count,
+                                      mi_curie_result *result) {
+    if (!context) return MI_INVALID_ARGUMENT;
+    lock_guard<mutex> guard(context->lock);
+    if (!result || (count > 0 && (!temperature_C || !capacitance_pF))) return failWith(context, MI_INVALID_ARGUMENT, "null array");
+    double C0 = vacuumCapacitance(context->sample);
+    CuriePrediction prediction = predictCurie(count, C0,
+                                              [&](size_t i) { return static_cast<double>(temperature_C[i]); },
+                                              [&](size_t i) { return capacitance_pF[i]; });
+    double peak_capacitance = 0;
+    for (size_t i = 0; i < count; i++) peak_capacitance = max(peak_capacitance, capacitance_pF[i]);
+    
+    result->peak_passed = prediction.peak_passed;
+    result->can_stop = prediction.can_stop;
+    result->points_after_peak = prediction.points_after_peak;
+    result->peak_temp_C = prediction.peak_temp_C;
+    result->peak_epsilon = peak_capacitance / C0;
+    result->predicted_curie_C = prediction.predicted_curie_C;
+    result->uncertainty_C = prediction.uncertainty_C;
+    result->curie_weiss_T0_C = prediction.curie_weiss_T0_C;
+    result->curie_constant_K = prediction.curie_constant;
+    result->fit_r2 = prediction.fit_r2;
+    result->expected_curie_C = context->sample.curie_temp_C;
+    return MI_OK;
+}
+
+// Features are built block by block in the context's scratch array and fed to the
+// compiled forest, so a batch of any size needs no allocation
+extern "C" mi_status mi_classify_hall(mi_context *context, const double *electron_density, const double *electron_mobility,
+                                      const double *hole_density, const double *hole_mobility, size_t count,
+                                      unsigned char *classes) {
+    if (!context) return MI_INVALID_ARGUMENT;
+    lock_guard<mutex> guard(context->lock);
+    if (count > 0 && (!electron_density || !electron_mobility || !hole_density || !hole_mobility || !classes)) {
+        return failWith(context, MI_INVALID_ARGUMENT, "null array");
+    }
+    const size_t block = sizeof(context->features) / sizeof(context->features[0]) / NUM_CARRIER_FEATURES;
+    for (size_t begin = 0; begin < count; begin += block) {
+        size_t n = min(block, count - begin);
+        for (size_t i = 0; i < n; i++) {
+            carrierFeatures(electron_density[begin + i], electron_mobility[begin + i], hole_density[begin + i],
+                            hole_mobility[begin + i], &context->features[i * NUM_CARRIER_FEATURES]);
+        }
+        classifyBatch(context->forest, context->features, n, classes + begin);
+    }
+    return MI_OK;
+}
+
+extern "C" mi_status mi_load_classifier(mi_context *context, const char *tree_text) {
+    if (!context) return MI_INVALID_ARGUMENT;
+    vector<DecisionTree> forest;
+    string error;
+    istringstream in(tree_text ? tree_text : default_material_tree);
+    bool parsed = parseForest(in, forest, error);
+    lock_guard<mutex> guard(context->lock);
+    if (!parsed) return failWith(context, MI_INVALID_CLASSIFIER, error.c_str());
+    context->forest = compileForest(forest);
+    return MI_OK;
+}
+
+extern "C" const char *mi_class_name(int material_class) {
+    return material_class >= 0 && material_class < NUM_MATERIAL_CLASSES ? material_class_names[material_class] : "Unknown";
+}
+
+void jsonOpen(JsonLinesWriter &writer, ofstream &out) {
+    writer.out = &out;
+    writer.buffer.resize(1 << 20);
+    writer.used = 0;
+    writer.first_field = true;
+}
+
+bool jsonFlush(JsonLinesWriter &writer) {
+    if (writer.used > 0) writer.out->write(&writer.buffer[0], writer.used);
+    writer.used = 0;
+    if (!*writer.out) {
+        cout << "\nError: Could not write JSON Lines output.\n";
+        return false;
+    }
+    return true;
+}
+
+// Makes room for bytes more characters and returns where they go
+static char *jsonReserve(JsonLinesWriter &writer, size_t bytes) {
+    if (writer.used + bytes > writer.buffer.size()) {
+        jsonFlush(writer);
+        if (bytes > writer.buffer.size()) writer.buffer.resize(bytes);
+    }
+    return &writer.buffer[writer.used];
+}
+
+// Writes ,"key": and returns the position after it; room for extra more bytes is reserved
+static char *jsonKey(JsonLinesWriter &writer, const char *key, size_t extra) {
+    size_t length = strlen(key);
+    char *p = jsonReserve(writer, length + 4 + extra);
+    if (!writer.first_field) *p++ = ',';
+    writer.first_field = false;
+    *p++ = '"';
+    memcpy(p, key, length);
+    p += length;
+    *p++ = '"';
+    *p++ = ':';
+    return p;
+}
+
+void jsonBeginRecord(JsonLinesWriter &writer) {
+    *jsonReserve(writer, 1) = '{';
+    writer.used++;
+    writer.first_field = true;
+}
+
+void jsonEndRecord(JsonLinesWriter &writer) {
+    char *p = jsonReserve(writer, 2);
+    p[0] = '}';
+    p[1] = '\n';
+    writer.used += 2;
+}
+
+// Shortest round-trip form with to_chars where the library has it; JSON has no NaN or
+// infinity, so those become null
+void jsonNumber(JsonLinesWriter &writer, const char *key, double value) {
+    const size_t room = 32;
+    char *p = jsonKey(writer, key, room);
+    if (value != value || value - value != 0) {
+        memcpy(p, "null", 4);
+        p += 4;
+    } else {
+#if __cplusplus >= 201703L
+        p = to_chars(p, p + room, value).ptr;
+#else
+        p += snprintf(p, room, "%.17g", value);
+#endif
+    }
+    writer.used = p - &writer.buffer[0];
+}
+
+void jsonInteger(JsonLinesWriter &writer, const char *key, int64_t value) {
+    const size_t room = 24;
+    char *p = jsonKey(writer, key, room);
+#if __cplusplus >= 201703L
+    p = to_chars(p, p + room, value).ptr;
+#else
+    char digits[24];
+    int count = 0;
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    do {
+        digits[count++] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) *p++ = '-';
+    while (count > 0) *p++ = digits[--count];
+#endif
+    writer.used = p - &writer.buffer[0];
+}
+
+void jsonString(JsonLinesWriter &writer, const char *key, const string &value) {
+    static const char hex[] = "0123456789abcdef";
+    char *p = jsonKey(writer, key, 6 * value.size() + 2);
+    *p++ = '"';
+    for (size_t i = 0; i < value.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(value[i]);
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = static_cast<char>(c);
+        } else if (c < 0x20) {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[c >> 4];
+            p[5] = hex[c & 15];
+            p += 6;
+        } else {
+            *p++ = static_cast<char>(c);
+        }
+    }
+    *p++ = '"';
+    writer.used = p - &writer.buffer[0];
+}
+
+// One "reading" record per reading, then a "run" record with the analysis. channel is
+// left out when negative.
+void writeJsonLinesReport(JsonLinesWriter &writer, const Sample &sample, const RunResult &result, int channel) {
+    const double nan = numeric_limits<double>::quiet_NaN();
+    for (size_t i = 0; i < sample.temp_capacitance_data.size(); i++) {
+        jsonBeginRecord(writer);
+        jsonString(writer, "type", "reading");
+        jsonString(writer, "material", sample.name);
+        if (channel >= 0) jsonInteger(writer, "channel", channel);
+        jsonInteger(writer, "temperature_C", sample.temp_capacitance_data[i].first);
+        jsonNumber(writer, "capacitance_pF", sample.temp_capacitance_data[i].second);
+        jsonNumber(writer, "epsilon_r", sample.temp_capacitance_data[i].second / result.C0);
+        jsonEndRecord(writer);
+    }
+    
+    bool fitted = sample.curie_temp_C > 0 && result.prediction.peak_passed;
+    jsonBeginRecord(writer);
+    jsonString(writer, "type", "run");
+    jsonString(writer, "material", sample.name);
+    if (channel >= 0) jsonInteger(writer, "channel", channel);
+    jsonInteger(writer, "timestamp", static_cast<int64_t>(time(0)));
+    jsonInteger(writer, "num_readings", static_cast<int64_t>(result.num_readings));
+    jsonNumber(writer, "C0_pF", result.C0);
+    jsonNumber(writer, "peak_epsilon", result.peak_epsilon);
+    jsonInteger(writer, "peak_temperature_C", result.peak_temp);
+    jsonNumber(writer, "expected_curie_C", sample.curie_temp_C > 0 ? sample.curie_temp_C : nan);
+    jsonNumber(writer, "curie_C", fitted ? result.prediction.predicted_curie_C : nan);
+    jsonNumber(writer, "curie_uncertainty_C", fitted ? result.prediction.uncertainty_C : nan);
+    jsonNumber(writer, "curie_weiss_T0_C", fitted ? result.prediction.curie_weiss_T0_C : nan);
+    jsonNumber(writer, "curie_constant_K", fitted ? result.prediction.curie_constant : nan);
+    jsonEndRecord(writer);
+}
+
+void chooseReportFormat() {
+    const char *names[] = {"Text report", "JSON Lines", "Text report and JSON Lines"};
+    int choice;
+    cout << "Current format: " << names[report_format] << "\n";
+    cout << "1. " << names[0] << "\n2. " << names[1] << "\n3. " << names[2] << "\nSelect (1-3): ";
+    while (!(cin >> choice) || choice < 1 || choice > 3) {
+        cout << "Invalid selection. Please enter a number between 1 and 3: ";
+        clearInputBuffer();
+    }
+    report_format = static_cast<ReportFormat>(choice - 1);
+    cout << "\nReports will be written as: " << names[report_format] << ".\n";
+}
+
+// Buffers are never freed: a trace must survive the worker threads that recorded it
+static mutex trace_registry_lock;
+static vector<TraceBuffer *> trace_buffers;
+static chrono::steady_clock::time_point trace_epoch = chrono::steady_clock::now();
+
+// Releases the thread's buffer for reuse when the thread exits
+struct TraceBufferLease {
+    TraceBuffer *buffer;
+    ~TraceBufferLease() {
+        if (!buffer) return;
+        lock_guard<mutex> guard(trace_registry_lock);
+        buffer->in_use = false;
+    }
+};
+
+static TraceBuffer &threadTraceBuffer() {
+    thread_local TraceBufferLease lease = {0};
+    if (!lease.buffer) {
+        lock_guard<mutex> guard(trace_registry_lock);
+        for (size_t i = 0; i < trace_buffers.size() && !lease.buffer; i++) {
+            if (!trace_buffers[i]->in_use) lease.buffer = trace_buffers[i];
+        }
+        if (!lease.buffer) {
+            lease.buffer = new TraceBuffer;
+            lease.buffer->lane = static_cast<int>(trace_buffers.size()) + 1;
+            trace_buffers.push_back(lease.buffer);
+        }
+        lease.buffer->in_use = true;
+    }
+    return *lease.buffer;
+}
+
+void recordTraceEvent(const char *name, chrono::steady_clock::time_point start) {
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    TraceEvent event = {name, chrono::duration_cast<chrono::microseconds>(start - trace_epoch).count(),
+                        chrono::duration_cast<chrono::microseconds>(end - start).count()};
+    threadTraceBuffer().events.push_back(event);
+}
+
+// Clears earlier events and turns recording on. Call between batches, not while
+// workers are recording.
+void startTracing() {
+    lock_guard<mutex> guard(trace_registry_lock);
+    for (size_t i = 0; i < trace_buffers.size(); i++) trace_buffers[i]->events.clear();
+    trace_epoch = chrono::steady_clock::now();
+    tracing_enabled = true;
+}
+
+// Writes every recorded event as a complete ("X") event, one lane per buffer
+bool writeChromeTrace(const string &filename) {
+    ofstream out(filename.c_str());
+    if (!out.is_open()) {
+        cout << "\nError: Could not create '" << filename << "'.\n";
+        return false;
+    }
+    lock_guard<mutex> guard(trace_registry_lock);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Material Identifier\"}}";
+    for (size_t b = 0; b < trace_buffers.size(); b++) {
+        const TraceBuffer &buffer = *trace_buffers[b];
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.lane
+            << ",\"args\":{\"name\":\"thread " << buffer.lane << "\"}}";
+        for (size_t e = 0; e < buffer.events.size(); e++) {
+            const TraceEvent &event = buffer.events[e];
+            out << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.lane
+                << ",\"ts\":" << event.start_us << ",\"dur\":" << event.duration_us << "}";
+        }
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+void traceTools() {
+    const char *trace_file = "trace.json";
+    int choice;
+    cout << "Tracing is " << (tracing_enabled ? "on" : "off") << ".\n";
+    cout << "1. Start tracing (clears earlier events)\n2. Stop tracing and export to " << trace_file << "\nSelect (1-2): ";
+    while (!(cin >> choice) || choice < 1 || choice > 2) {
+        cout << "Invalid selection. Please enter 1 or 2: ";
+        clearInputBuffer();
+    }
+    if (choice == 1) {
+        startTracing();
+        cout << "\nTracing started. Run a simulation or plate run, then export.\n";
+        return;
+    }
+    
+    tracing_enabled = false;
+    size_t events = 0, lanes;
+    {
+        lock_guard<mutex> guard(trace_registry_lock);
+        lanes = trace_buffers.size();
+        for (size_t i = 0; i < lanes; i++) events += trace_buffers[i]->events.size();
+    }
+    if (writeChromeTrace(trace_file)) {
+        cout << "\nWrote " << events << " events on " << lanes << " thread(s) to '" << trace_file
+             << "'. Open it in chrome://tracing or ui.perfetto.dev.\n";
+    }
+}
+
+static LatencyHistogram latency_histograms[NUM_LATENCY_STAGES];
+static atomic<bool> latency_dumps_running(false);
+static atomic<unsigned> latency_dump_generation(0);
+
+// Below 64 ns buckets are exact; above, bucket e·64 + (ns >> e) where ns >> e is in [64, 128)
+size_t latencyBucket(uint64_t ns) {
+    if (ns < static_cast<uint64_t>(latency_sub_buckets)) return static_cast<size_t>(ns);
+    int msb = 63;
+#ifdef __GNUC__
+    msb -= __builtin_clzll(ns);
+#else
+    while (!(ns >> msb)) msb--;
+#endif
+    int exponent = msb - 6;
+    size_t bucket = static_cast<size_t>(exponent) * latency_sub_buckets + static_cast<size_t>(ns >> exponent);
+    return min(bucket, static_cast<size_t>(latency_buckets - 1));
+}
+
+// Highest value that lands in a bucket
+uint64_t latencyBucketValue(size_t bucket) {
+    if (bucket < static_cast<size_t>(latency_sub_buckets)) return bucket;
+    int exponent = static_cast<int>(bucket / latency_sub_buckets) - 1;
+    uint64_t sub = bucket - static_cast<uint64_t>(exponent) * latency_sub_buckets;
+    return ((sub + 1) << exponent) - 1;
+}
+
+void recordLatency(LatencyStage stage, chrono::steady_clock::duration elapsed) {
+    uint64_t ns = static_cast<uint64_t>(max<int64_t>(0, chrono::duration_cast<chrono::nanoseconds>(elapsed).count()));
+    LatencyHistogram &h = latency_histograms[stage];
+    h.counts[latencyBucket(ns)].fetch_add(1, memory_order_relaxed);
+    h.total.fetch_add(1, memory_order_relaxed);
+    h.sum_ns.fetch_add(ns, memory_order_relaxed);
+    uint64_t seen = h.max_ns.load(memory_order_relaxed);
+    while (ns > seen && !h.max_ns.compare_exchange_weak(seen, ns, memory_order_relaxed)) {}
+}
+
+// Snapshot of one histogram; recording may continue meanwhile. Returns the count.
+static uint64_t latencySnapshot(int stage, vector<uint64_t> &counts) {
+    LatencyHistogram &h = latency_histograms[stage];
+    counts.resize(latency_buckets);
+    uint64_t total = 0;
+    for (int b = 0; b < latency_buckets; b++) {
+        counts[b] = h.counts[b].load(memory_order_relaxed);
+        total += counts[b];
+    }
+    return total;
+}
+
+// Quantiles (ascending) of a snapshot in ns. Each is its bucket's upper edge, never
+// above the recorded maximum.
+static void latencyQuantiles(const vector<uint64_t> &counts, uint64_t total, uint64_t max_ns,
+                             const double *quantiles, int num_quantiles, uint64_t *values) {
+    size_t bucket = 0;
+    uint64_t below = counts[0];
+    for (int q = 0; q < num_quantiles; q++) {
+        uint64_t rank = static_cast<uint64_t>(ceil(quantiles[q] * total));
+        while (below < rank && bucket + 1 < counts.size()) below += counts[++bucket];
+        values[q] = min(latencyBucketValue(bucket), max_ns);
+    }
+}
+
+void printLatencyPercentiles(ostream &out) {
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    out << left << setw(28) << "Stage (µs)" << right << setw(10) << "Count" << setw(11) << "Mean" << setw(11) << "p50"
+        << setw(11) << "p90" << setw(11) << "p99" << setw(11) << "p99.9" << setw(11) << "Max" << "\n";
+    vector<uint64_t> counts;
+    for (int stage = 0; stage < NUM_LATENCY_STAGES; stage++) {
+        LatencyHistogram &h = latency_histograms[stage];
+        uint64_t total = latencySnapshot(stage, counts);
+        out << left << setw(27) << latency_stage_names[stage] << right << setw(10) << total << fixed << setprecision(1);
+        if (total == 0) {
+            out << setw(11) << "-" << setw(11) << "-" << setw(11) << "-" << setw(11) << "-" << setw(11) << "-" << setw(11) << "-" << "\n";
+            continue;
+        }
+        out << setw(11) << h.sum_ns.load(memory_order_relaxed) / 1e3 / max<uint64_t>(h.total.load(memory_order_relaxed), 1);
+        uint64_t max_ns = h.max_ns.load(memory_order_relaxed);
+        uint64_t values[4];
+        latencyQuantiles(counts, total, max_ns, quantiles, 4, values);
+        for (int q = 0; q < 4; q++) out << setw(11) << values[q] / 1e3;
+        out << setw(11) << max_ns / 1e3 << "\n";
+    }
+}
+
+// Appends a percentile table to the log every interval until stopped or restarted
+static void runLatencyDumps(unsigned generation, int interval_seconds, string filename) {
+    chrono::steady_clock::time_point next = chrono::steady_clock::now() + chrono::seconds(interval_seconds);
+    while (latency_dumps_running && latency_dump_generation == generation) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        if (chrono::steady_clock::now() < next) continue;
+        next += chrono::seconds(interval_seconds);
+        ofstream out(filename.c_str(), ios::app);
+        time_t now = time(0);
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+        out << "# " << stamp << "\n";
+        printLatencyPercentiles(out);
+        out << "\n";
+    }
+}
+
+void latencyTools() {
+    const char *log_file = "latency_log.txt";
+    int choice;
+    cout << "1. Show percentiles\n2. Start periodic dumps to " << log_file << "\n3. Stop periodic dumps\n"
+            "4. Reset histograms\nSelect (1-4): ";
+    while (!(cin >> choice) || choice < 1 || choice > 4) {
+        cout << "Invalid selection. Please enter a number between 1 and 4: ";
+        clearInputBuffer();
+    }
+    
+    if (choice == 1) {
+        cout << "\n------ LATENCY PERCENTILES ------\n";
+        printLatencyPercentiles(cout);
+    } else if (choice == 2) {
+        int interval;
+        cout << "Dump interval in seconds (1-3600): ";
+        while (!(cin >> interval) || interval < 1 || interval > 3600) {
+            cout << "Invalid input. Please enter a number between 1 and 3600: ";
+            clearInputBuffer();
+        }
+        // A new generation retires any dump thread already running
+        unsigned generation = ++latency_dump_generation;
+        latency_dumps_running = true;
+        thread(runLatencyDumps, generation, interval, string(log_file)).detach();
+        cout << "\nPercentiles will be appended to '" << log_file << "' every " << interval << " s.\n";
+    } else if (choice == 3) {
+        latency_dumps_running = false;
+        cout << "\nPeriodic dumps stopped.\n";
+    } else {
+        for (int stage = 0; stage < NUM_LATENCY_STAGES; stage++) {
+            LatencyHistogram &h = latency_histograms[stage];
+            for (int b = 0; b < latency_buckets; b++) h.counts[b] = 0;
+            h.total = 0;
+            h.sum_ns = 0;
+            h.max_ns = 0;
+        }
+        cout << "\nHistograms cleared.\n";
+    }
+}
+
+const char *const metric_counter_names[NUM_METRIC_COUNTERS][2] = {
+    {"mi_readings_ingested_total", "Capacitance readings accepted; rate() gives readings per second."},
+    {"mi_runs_analyzed_total", "Samples run through the Curie analysis."},
+    {"mi_runs_stored_total", "Run records appended to the run store."}
+};
+const char *const latency_stage_labels[NUM_LATENCY_STAGES] = {
+    "reading_to_estimate", "sample_analysis", "plate_run"
+};
+
+// The padding after the counters keeps shards allocated one after another from sharing
+// a cache line, so threads counting side by side do not contend
+struct MetricsShard {
+    atomic<uint64_t> counters[NUM_METRIC_COUNTERS];
+    bool in_use;
+    char padding[64];
+};
+
+// Shards are never freed: counts of finished threads still belong in the totals, and
+// the next new thread continues counting into a released shard
+static mutex metrics_registry_lock;
+static vector<MetricsShard *> metrics_shards;
+static vector<pair<const atomic<size_t> *, size_t> > work_queues;
+static chrono::steady_clock::time_point process_start = chrono::steady_clock::now();
+
+#ifndef MATERIAL_IDENTIFIER_LIBRARY
+struct MetricsShardLease {
+    MetricsShard *shard;
+    ~MetricsShardLease() {
+        if (!shard) return;
+        lock_guard<mutex> guard(metrics_registry_lock);
+        shard->in_use = false;
+    }
+};
+
+static MetricsShard &threadMetricsShard() {
+    thread_local MetricsShardLease lease = {0};
+    if (!lease.shard) {
+        lock_guard<mutex> guard(metrics_registry_lock);
+        for (size_t i = 0; i < metrics_shards.size() && !lease.shard; i++) {
+            if (!metrics_shards[i]->in_use) lease.shard = metrics_shards[i];
+        }
+        if (!lease.shard) {
+            lease.shard = new MetricsShard;
+            for (int c = 0; c < NUM_METRIC_COUNTERS; c++) lease.shard->counters[c] = 0;
+            metrics_shards.push_back(lease.shard);
+        }
+        lease.shard->in_use = true;
+    }
+    return *lease.shard;
+}
+
+// Only the owning thread writes a shard, so a plain load and store replaces the locked add
+void countMetric(MetricCounter counter, uint64_t amount) {
+    atomic<uint64_t> &value = threadMetricsShard().counters[counter];
+    value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+void registerWorkQueue(const atomic<size_t> *next, size_t n) {
+    lock_guard<mutex> guard(metrics_registry_lock);
+    work_queues.push_back(make_pair(next, n));
+}
+
+void unregisterWorkQueue(const atomic<size_t> *next) {
+    lock_guard<mutex> guard(metrics_registry_lock);
+    for (size_t i = 0; i < work_queues.size(); i++) {
+        if (work_queues[i].first == next) {
+            work_queues.erase(work_queues.begin() + i);
+            break;
+        }
+    }
+}
+#endif
+
+// Prometheus text exposition format 0.0.4
+string formatPrometheusMetrics() {
+    ostringstream out;
+    out << setprecision(9);
+    uint64_t totals[NUM_METRIC_COUNTERS] = {0};
+    size_t threads = 0, queues = 0, queued_items = 0;
+    {
+        lock_guard<mutex> guard(metrics_registry_lock);
+        for (size_t i = 0; i < metrics_shards.size(); i++) {
+            for (int c = 0; c < NUM_METRIC_COUNTERS; c++) totals[c] += metrics_shards[i]->counters[c].load(memory_order_relaxed);
+            if (metrics_shards[i]->in_use) threads++;
+        }
+        queues = work_queues.size();
+        for (size_t i = 0; i < work_queues.size(); i++) {
+            size_t taken = work_queues[i].first->load(memory_order_relaxed);
+            if (taken < work_queues[i].second) queued_items += work_queues[i].second - taken;
+        }
+    }
+    
+    for (int c = 0; c < NUM_METRIC_COUNTERS; c++) {
+        out << "# HELP " << metric_counter_names[c][0] << " " << metric_counter_names[c][1] << "\n";
+        out << "# TYPE " << metric_counter_names[c][0] << " counter\n";
+        out << metric_counter_names[c][0] << " " << totals[c] << "\n";
+    }
+    out << "# HELP mi_work_queue_depth Items not yet taken by workers, over all running parallel loops.\n"
+        << "# TYPE mi_work_queue_depth gauge\nmi_work_queue_depth " << queued_items << "\n";
+    out << "# HELP mi_work_queues_active Parallel loops running.\n"
+        << "# TYPE mi_work_queues_active gauge\nmi_work_queues_active " << queues << "\n";
+    out << "# HELP mi_counting_threads Live threads that have counted metrics.\n"
+        << "# TYPE mi_counting_threads gauge\nmi_counting_threads " << threads << "\n";
+    out << "# HELP mi_uptime_seconds Seconds since the process started.\n"
+        << "# TYPE mi_uptime_seconds gauge\nmi_uptime_seconds "
+        << chrono::duration<double>(chrono::steady_clock::now() - process_start).count() << "\n";
+    
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    const char *const quantile_labels[] = {"0.5", "0.9", "0.99", "0.999"};
+    out << "# HELP mi_stage_latency_seconds Latency of pipeline stages.\n# TYPE mi_stage_latency_seconds summary\n";
+    vector<uint64_t> counts;
+    for (int stage = 0; stage < NUM_LATENCY_STAGES; stage++) {
+        LatencyHistogram &h = latency_histograms[stage];
+        uint64_t total = latencySnapshot(stage, counts);
+        uint64_t values[4] = {0};
+        if (total > 0) latencyQuantiles(counts, total, h.max_ns.load(memory_order_relaxed), quantiles, 4, values);
+        for (int q = 0; q < 4; q++) {
+            out << "mi_stage_latency_seconds{stage=\"" << latency_stage_labels[stage] << "\",quantile=\"" << quantile_labels[q] << "\"} ";
+            if (total > 0) out << values[q] / 1e9 << "\n";
+            else out << "NaN\n";
+        }
+        out << "mi_stage_latency_seconds_sum{stage=\"" << latency_stage_labels[stage] << "\"} "
+            << h.sum_ns.load(memory_order_relaxed) / 1e9 << "\n";
+        out << "mi_stage_latency_seconds_count{stage=\"" << latency_stage_labels[stage] << "\"} " << total << "\n";
+    }
+    return out.str();
+}
+
+#ifdef METRICS_HTTP_SUPPORTED
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static atomic<bool> metrics_server_running(false);
+static atomic<bool> metrics_server_listening(false); // until the serving thread has closed its socket
+static int metrics_server_port = 0;
+
+// Answers each connection with the current metrics and closes it. Polls so that a stop
+// is noticed within 200 ms.
+static void serveMetrics(int listen_fd) {
+    while (metrics_server_running) {
+        pollfd listener = {listen_fd, POLLIN, 0};
+        if (poll(&listener, 1, 200) <= 0) continue;
+        int client = accept(listen_fd, 0, 0);
+        if (client < 0) continue;
+        
+        timeval timeout = {1, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char request[4096];
+        ssize_t received = recv(client, request, sizeof(request) - 1, 0);
+        string response;
+        if (received > 0) {
+            request[received] = '\0';
+            bool wanted = strncmp(request, "GET /metrics", 12) == 0 || strncmp(request, "GET / ", 6) == 0;
+            string body = wanted ? formatPrometheusMetrics() : string("Not found\n");
+            ostringstream header;
+            header << (wanted ? "HTTP/1.1 200 OK\r\n" : "HTTP/1.1 404 Not Found\r\n")
+                   << "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                   << "Content-Length: " << body.size() << "\r\nConnection: close\r\n\r\n";
+            response = header.str() + body;
+        }
+        for (size_t sent = 0; sent < response.size();) {
+            ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += static_cast<size_t>(n);
+        }
+        close(client);
+    }
+    close(listen_fd);
+    metrics_server_listening = false;
+}
+
+// Listens on 127.0.0.1 only; the metrics are not meant for other hosts
+static bool startMetricsServer(int port) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        cout << "\nError: Could not create a socket.\n";
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(listen_fd, 16) < 0) {
+        cout << "\nError: Could not listen on port " << port << ": " << strerror(errno) << "\n";
+        close(listen_fd);
+        return false;
+    }
+    metrics_server_running = metrics_server_listening = true;
+    metrics_server_port = port;
+    thread(serveMetrics, listen_fd).detach();
+    return true;
+}
+
+// Waits for the serving thread to close the listening socket, so the port can be
+// bound again as soon as this returns
+static void stopMetricsServer() {
+    metrics_server_running = false;
+    while (metrics_server_listening) this_thread::sleep_for(chrono::milliseconds(10));
+}
+#endif
+
+void metricsTools() {
+    int choice;
+    cout << "1. Start endpoint on localhost\n2. Stop endpoint\n3. Show current metrics\nSelect (1-3): ";
+    while (!(cin >> choice) || choice < 1 || choice > 3) {
+        cout << "Invalid selection. Please enter a number between 1 and 3: ";
+        clearInputBuffer();
+    }
+    
+    if (choice == 3) {
+        cout << "\n------ METRICS ------\n" << formatPrometheusMetrics();
+        return;
+    }
+#ifdef METRICS_HTTP_SUPPORTED
+    if (choice == 1) {
+        if (metrics_server_running) {
+            cout << "\nAlready serving on http://127.0.0.1:" << metrics_server_port << "/metrics\n";
+            return;
+        }
+        int port;
+        cout << "Port (1024-65535): ";
+        while (!(cin >> port) || port < 1024 || port > 65535) {
+            cout << "Invalid input. Please enter a number between 1024 and 65535: ";
+            clearInputBuffer();
+        }
+        if (startMetricsServer(port)) cout << "\nServing metrics on http://127.0.0.1:" << port << "/metrics\n";
+    } else {
+        stopMetricsServer();
+        cout << "\nMetrics endpoint stopped.\n";
+    }
+#else
+    cout << "\nThe metrics endpoint needs POSIX sockets, which this platform lacks.\n";
+#endif
+}
+
+#ifdef PERF_COUNTERS_SUPPORTED
+static int openPerfEvent(uint64_t config, int group_fd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group_fd == -1;  // members follow the leader
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+#endif
+
+// Opens the events as one group on the calling thread, so they count the same instructions
+void openPerfCounters(PerfCounterGroup &group) {
+    group.num_open = 0;
+    group.status.clear();
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) group.fds[e] = -1;
+#ifdef PERF_COUNTERS_SUPPORTED
+    const uint64_t configs[NUM_PERF_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    int leader = -1;
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        group.fds[e] = openPerfEvent(configs[e], leader);
+        if (group.fds[e] < 0) {
+            if (group.status.empty()) group.status = string("perf_event_open: ") + strerror(errno);
+            group.fds[e] = -1;
+            continue;
+        }
+        if (leader == -1) leader = group.fds[e];
+        group.order[group.num_open++] = e;
+    }
+#else
+    group.status = "hardware counters need Linux perf_event_open";
+#endif
+}
+
+void closePerfCounters(PerfCounterGroup &group) {
+#ifdef PERF_COUNTERS_SUPPORTED
+    for (int e = NUM_PERF_EVENTS - 1; e >= 0; e--) {
+        if (group.fds[e] >= 0) close(group.fds[e]);
+        group.fds[e] = -1;
+    }
+#endif
+    group.num_open = 0;
+}
+
+void startPerfCounters(PerfCounterGroup &group) {
+#ifdef PERF_COUNTERS_SUPPORTED
+    if (group.num_open == 0) return;
+    int leader = group.fds[group.order[0]];
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+    (void)group;
+#endif
+}
+
+// Stores the counts in the point, scaled up if the kernel multiplexed the counters
+void stopPerfCounters(PerfCounterGroup &group, BenchmarkPoint &point) {
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        point.counters[e] = 0;
+        point.counted[e] = false;
+    }
+#ifdef PERF_COUNTERS_SUPPORTED
+    if (group.num_open == 0) return;
+    int leader = group.fds[group.order[0]];
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t data[3 + NUM_PERF_EVENTS];
+    ssize_t bytes = read(leader, data, sizeof(data));
+    if (bytes < static_cast<ssize_t>(3 * sizeof(uint64_t)) || data[2] == 0) return;
+    double scale = static_cast<double>(data[1]) / data[2];
+    for (uint64_t i = 0; i < data[0] && static_cast<int>(i) < group.num_open; i++) {
+        point.counters[group.order[i]] = static_cast<uint64_t>(data[3 + i] * scale);
+        point.counted[group.order[i]] = true;
+    }
+#else
+    (void)group;
+#endif
+}
+
+// Runs a kernel until it has taken at least 50 ms (after one untimed warm-up call),
+// with counters around the timed calls
+template <class Kernel>
+BenchmarkPoint measureKernel(const char *name, size_t size, PerfCounterGroup &counters, Kernel kernel) {
+    BenchmarkPoint point;
+    point.kernel = name;
+    point.size = size;
+    point.items = 0;
+    kernel();
+    startPerfCounters(counters);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    do {
+        kernel();
+        point.items += size;
+        point.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    } while (point.seconds < 0.05);
+    stopPerfCounters(counters, point);
+    return point;
+}
+
+// The parse, epsilon, peak-search and classifier kernels, each at a cache-resident, an
+// L2/L3-sized and a memory-sized input. Kernels run on the calling thread, which is the
+// one the counters follow.
+vector<BenchmarkPoint> runBenchmarkSuite(PerfCounterGroup &counters) {
+    vector<BenchmarkPoint> points;
+    mt19937 rng(2024);
+    
+    const size_t parse_sizes[] = {1000, 10000, 100000};
+    for (int s = 0; s < 3; s++) {
+        ostringstream text;
+        for (size_t i = 0; i < parse_sizes[s]; i++) {
+            text << 1 + i % 16 << " " << 20 + static_cast<int>(i / 16) % 200 << " " << 1000.0 + rng() % 100000 / 10.0 << "\n";
+        }
+        string plate = text.str();
+        points.push_back(measureKernel("parse", parse_sizes[s], counters, [&]() {
+            istringstream in(plate);
+            MultiplexedRun run;
+            parseMultiplexedRun(in, run);
+        }));
+    }
+    
+    const size_t epsilon_sizes[] = {4096, 262144, 4194304};
+    mi_context *context = mi_context_create();
+    mi_set_sample(context, "Barium Titanate", 100.0, 1.0);
+    for (int s = 0; s < 3; s++) {
+        vector<double> capacitance(epsilon_sizes[s]), epsilon(epsilon_sizes[s]);
+        for (size_t i = 0; i < capacitance.size(); i++) capacitance[i] = 100.0 + rng() % 100000;
+        points.push_back(measureKernel("epsilon", epsilon_sizes[s], counters, [&]() {
+            mi_epsilon(context, &capacitance[0], capacitance.size(), &epsilon[0]);
+        }));
+    }
+    mi_context_destroy(context);
+    
+    // Curie-Weiss sweeps peaking in the middle
+    const size_t sweep_sizes[] = {128, 4096, 131072};
+    for (int s = 0; s < 3; s++) {
+        size_t n = sweep_sizes[s];
+        vector<double> T(n), C(n);
+        for (size_t i = 0; i < n; i++) {
+            T[i] = 20.0 + 200.0 * i / n;
+            C[i] = 1.5e5 / (fabs(T[i] - 120.0) + 10.0) * (1.0 + (rng() % 1000) * 1e-6);
+        }
+        volatile double sink = 0;
+        points.push_back(measureKernel("peak search", n, counters, [&]() {
+            sink = predictCurie(n, 8.85, [&](size_t i) { return T[i]; }, [&](size_t i) { return C[i]; }).predicted_curie_C;
+        }));
+    }
+    
+    const size_t classify_sizes[] = {1024, 65536, 1048576};
+    uniform_real_distribution<double> log_sigma(-14.0, 6.0), log_density(8.0, 23.5), log_mobility(-1.0, 5.0);
+    for (int s = 0; s < 3; s++) {
+        size_t n = classify_sizes[s];
+        vector<double> features(n * NUM_CARRIER_FEATURES);
+        for (size_t i = 0; i < n; i++) {
+            double *x = &features[i * NUM_CARRIER_FEATURES];
+            x[FEATURE_LOG_CONDUCTIVITY] = log_sigma(rng);
+            x[FEATURE_LOG_MAJORITY_DENSITY] = log_density(rng);
+            x[FEATURE_MAJORITY_SIGN] = rng() % 2 ? 1.0 : -1.0;
+            x[FEATURE_LOG_MAJORITY_MOBILITY] = log_mobility(rng);
+        }
+        vector<unsigned char> classes(n);
+        points.push_back(measureKernel("classify", n, counters, [&]() {
+            classifyBatch(activeMaterialForest(), &features[0], n, &classes[0]);
+        }));
+    }
+    return points;
+}
+
+void printBenchmarkPoints(const vector<BenchmarkPoint> &points, const PerfCounterGroup &counters) {
+    if (!counters.status.empty()) cout << "Hardware counters: " << (counters.num_open ? "partly " : "") << "unavailable (" << counters.status << ")\n";
+    cout << left << setw(13) << "Kernel" << right << setw(9) << "Size" << setw(11) << "ns/item" << setw(11) << "M items/s"
+         << setw(8) << "IPC" << setw(15) << "Cache miss/1k" << setw(16) << "Branch miss/1k" << "\n";
+    for (size_t i = 0; i < points.size(); i++) {
+        const BenchmarkPoint &p = points[i];
+        double per_kilo_item = 1000.0 / max<size_t>(p.items, 1);
+        cout << left << setw(13) << p.kernel << right << setw(9) << p.size << fixed << setprecision(2)
+             << setw(11) << p.seconds * 1e9 / max<size_t>(p.items, 1) << setw(11) << p.items / max(p.seconds, 1e-9) / 1e6;
+        if (p.counted[PERF_CYCLES] && p.counted[PERF_INSTRUCTIONS] && p.counters[PERF_CYCLES] > 0) {
+            cout << setw(8) << static_cast<double>(p.counters[PERF_INSTRUCTIONS]) / p.counters[PERF_CYCLES];
+        } else {
+            cout << setw(8) << "-";
+        }
+        if (p.counted[PERF_CACHE_MISSES]) cout << setw(15) << p.counters[PERF_CACHE_MISSES] * per_kilo_item;
+        else cout << setw(15) << "-";
+        if (p.counted[PERF_BRANCH_MISSES]) cout << setw(16) << p.counters[PERF_BRANCH_MISSES] * per_kilo_item;
+        else cout << setw(16) << "-";
+        cout << "\n";
+    }
+}
+
+void benchmarkSuite() {
+    PerfCounterGroup counters;
+    openPerfCounters(counters);
+    cout << "\nRunning kernel benchmarks...\n";
+    vector<BenchmarkPoint> points = runBenchmarkSuite(counters);
+    closePerfCounters(counters);
+    cout << "\n------ KERNEL BENCHMARKS ------\n";
+    printBenchmarkPoints(points, counters);
+}
+
+// Runs the whole suite repeatedly, so drift over the run affects every point alike
+vector<BenchmarkStats> measureBenchmarkStats(int repetitions) {
+    PerfCounterGroup counters;
+    counters.num_open = 0;  // wall time only
+    vector<vector<double> > samples;
+    vector<BenchmarkPoint> points;
+    for (int r = 0; r < repetitions; r++) {
+        cout << "Benchmark run " << r + 1 << " of " << repetitions << "...\n";
+        points = runBenchmarkSuite(counters);
+        samples.resize(points.size());
+        for (size_t i = 0; i < points.size(); i++) samples[i].push_back(points[i].seconds * 1e9 / points[i].items);
+    }
+    
+    vector<BenchmarkStats> stats(points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+        double sum = 0, sum_sq = 0;
+        for (int r = 0; r < repetitions; r++) sum += samples[i][r];
+        double mean = sum / repetitions;
+        for (int r = 0; r < repetitions; r++) sum_sq += (samples[i][r] - mean) * (samples[i][r] - mean);
+        stats[i].kernel = points[i].kernel;
+        stats[i].size = points[i].size;
+        stats[i].repetitions = repetitions;
+        stats[i].mean_ns = mean;
+        stats[i].stddev_ns = repetitions > 1 ? sqrt(sum_sq / (repetitions - 1)) : 0;
+    }
+    return stats;
+}
+
+// One point per line: <size> <repetitions> <mean ns/item> <stddev ns/item> <kernel>
+bool saveBenchmarkBaseline(const vector<BenchmarkStats> &stats) {
+    ofstream out(benchmark_baseline_file);
+    if (!out.is_open()) {
+        cout << "\nError: Could not create '" << benchmark_baseline_file << "'.\n";
+        return false;
+    }
+    out << "# size repetitions mean_ns stddev_ns kernel\n" << setprecision(17);
+    for (size_t i = 0; i < stats.size(); i++) {
+        out << stats[i].size << " " << stats[i].repetitions << " " << stats[i].mean_ns << " "
+            << stats[i].stddev_ns << " " << stats[i].kernel << "\n";
+    }
+    return static_cast<bool>(out);
+}
+
+bool loadBenchmarkBaseline(vector<BenchmarkStats> &stats) {
+    ifstream in(benchmark_baseline_file);
+    if (!in.is_open()) return false;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream fields(line);
+        BenchmarkStats s;
+        if (fields >> s.size >> s.repetitions >> s.mean_ns >> s.stddev_ns && getline(fields >> ws, s.kernel) &&
+            s.repetitions > 1 && s.mean_ns > 0) {
+            stats.push_back(s);
+        }
+    }
+    return true;
+}
+
+// Two-sided 95% quantile of Student's t
+static double studentT95(double df) {
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (df < 1) return table[0];
+    if (df >= 30) return 1.96 + 2.4 / df;  // within 0.005 of the exact value
+    return table[static_cast<int>(df) - 1];
+}
+
+// Welch's 95% confidence interval for the change in mean time per item. A point has
+// regressed when the whole interval lies above threshold (a fraction of the baseline),
+// so noise alone does not fail the gate. Returns the number of regressed points.
+int compareBenchmarks(const vector<BenchmarkStats> &current, const vector<BenchmarkStats> &baseline, double threshold) {
+    int regressed = 0;
+    cout << fixed << setprecision(2);
+    cout << left << setw(13) << "Kernel" << right << setw(9) << "Size" << setw(12) << "Base ns" << setw(12) << "Now ns"
+         << setw(10) << "Change" << setw(22) << "95% CI" << "  Verdict\n";
+    for (size_t i = 0; i < current.size(); i++) {
+        const BenchmarkStats &now = current[i];
+        const BenchmarkStats *base = 0;
+        for (size_t j = 0; j < baseline.size() && !base; j++) {
+            if (baseline[j].kernel == now.kernel && baseline[j].size == now.size) base = &baseline[j];
+        }
+        cout << left << setw(13) << now.kernel << right << setw(9) << now.size;
+        if (!base) {
+            cout << setw(12) << "-" << setw(12) << now.mean_ns << setw(10) << "-" << setw(22) << "-" << "  not in baseline\n";
+            continue;
+        }
+        
+        double var_now = now.stddev_ns * now.stddev_ns / now.repetitions;
+        double var_base = base->stddev_ns * base->stddev_ns / base->repetitions;
+        double se = sqrt(var_now + var_base);
+        double df = se > 0 ? pow(se, 4) / (var_now * var_now / (now.repetitions - 1) + var_base * var_base / (base->repetitions - 1))
+                           : 1e9;
+        double change = (now.mean_ns - base->mean_ns) / base->mean_ns;
+        double half_width = studentT95(df) * se / base->mean_ns;
+        
+        const char *verdict = "unchanged";
+        if (change - half_width > threshold) {
+            verdict = "REGRESSED";
+            regressed++;
+        } else if (change + half_width < -threshold) {
+            verdict = "faster";
+        }
+        ostringstream interval;
+        interval << fixed << setprecision(1) << "[" << 100 * (change - half_width) << "%, " << 100 * (change + half_width) << "%]";
+        cout << setw(12) << base->mean_ns << setw(12) << now.mean_ns << setw(9) << 100 * change << "%"
+             << setw(22) << interval.str() << "  " << verdict << "\n";
+    }
+    return regressed;
+}
+
+// Exit status for the command line: 0 passed (or baseline saved), 1 regressed, 2 no baseline
+int runRegressionGate(int repetitions, double threshold, bool save_baseline) {
+    vector<BenchmarkStats> baseline;
+    if (!save_baseline && (!loadBenchmarkBaseline(baseline) || baseline.empty())) {
+        cout << "\nError: No baseline in '" << benchmark_baseline_file << "'. Save one from a known-good build first.\n";
+        return 2;
+    }
+    vector<BenchmarkStats> current = measureBenchmarkStats(repetitions);
+    if (save_baseline) {
+        if (!saveBenchmarkBaseline(current)) return 2;
+        cout << "\nBaseline of " << current.size() << " benchmark points saved to '" << benchmark_baseline_file << "'.\n";
+        return 0;
+    }
+    
+    cout << "\n------ REGRESSION GATE (threshold " << fixed << setprecision(1) << threshold * 100 << "%) ------\n";
+    int regressed = compareBenchmarks(current, baseline, threshold);
+    if (regressed > 0) {
+        cout << "\nFAILED: " << regressed << " benchmark point(s) slower than the baseline by more than the threshold.\n";
+        return 1;
+    }
+    cout << "\nPASSED: no benchmark point regressed.\n";
+    return 0;
+}
+
+void regressionGate() {
+    int choice, repetitions;
+    double threshold_percent = 10.0;
+    cout << "1. Compare against the stored baseline\n2. Save a new baseline\nSelect (1-2): ";
+    while (!(cin >> choice) || choice < 1 || choice > 2) {
+        cout << "Invalid selection. Please enter 1 or 2: ";
+        clearInputBuffer();
+    }
+    cout << "Repetitions of the suite (2-50): ";
+    while (!(cin >> repetitions) || repetitions < 2 || repetitions > 50) {
+        cout << "Invalid input. Please enter a number between 2 and 50: ";
+        clearInputBuffer();
+    }
+    if (choice == 1) {
+        cout << "Regression threshold in percent (e.g. 10): ";
+        while (!(cin >> threshold_percent) || threshold_percent <= 0) {
+            cout << "Invalid input. Please enter a positive number: ";
+            clearInputBuffer();
+        }
+    }
+    runRegressionGate(repetitions, threshold_percent / 100.0, choice == 2);
+}
+
+thread_local MemoryStage current_memory_stage = MEMORY_OTHER;
+
+#ifndef MATERIAL_IDENTIFIER_LIBRARY
+// Memory counters are kept per thread, like the metrics shards, so operator new costs a
+// load and a store per counter rather than a locked add. Only the owning thread writes
+// live bytes, peaks and allocation counts; a block freed on another thread is refunded
+// through freed_elsewhere, the one counter other threads add to. The slots are a fixed
+// array because claiming one must not allocate, and a released slot keeps its counts for
+// the next thread, since blocks of a finished worker may still be live. Slot 0 is shared
+// by threads that hold no slot and is updated with atomic adds.
+const int memory_total = NUM_MEMORY_STAGES;  // index of the all-stage counters
+const int num_memory_slots = 128;
+
+struct MemorySlot {
+    atomic<int64_t> live_bytes[NUM_MEMORY_STAGES + 1];
+    atomic<int64_t> freed_elsewhere[NUM_MEMORY_STAGES + 1];
+    atomic<int64_t> peak_bytes[NUM_MEMORY_STAGES + 1];
+    atomic<uint64_t> allocations[NUM_MEMORY_STAGES];
+    atomic<unsigned> run;  // memory run the peaks and allocation counts belong to
+    atomic<bool> in_use;
+    char padding[64];
+};
+static MemorySlot memory_slots[num_memory_slots];
+static atomic<unsigned> memory_run(0);
+
+// slot is 0 before the first allocation and -1 once the thread is exiting
+struct MemorySlotLease {
+    int slot;
+    ~MemorySlotLease() {
+        if (slot > 0) memory_slots[slot].in_use.store(false, memory_order_release);
+        slot = -1;
+    }
+};
+static thread_local MemorySlotLease memory_lease = {0};
+
+static int threadMemorySlot() {
+    if (memory_lease.slot == 0) {
+        for (int i = 1; i < num_memory_slots; i++) {
+            bool free_slot = false;
+            if (!memory_slots[i].in_use.load(memory_order_relaxed) &&
+                memory_slots[i].in_use.compare_exchange_strong(free_slot, true, memory_order_acquire)) {
+                memory_lease.slot = i;
+                return i;
+            }
+        }
+        return 0;  // all taken: try again at the next allocation
+    }
+    return max(memory_lease.slot, 0);
+}
+
+static int64_t netLiveBytes(const MemorySlot &slot, int index) {
+    return slot.live_bytes[index].load(memory_order_relaxed) - slot.freed_elsewhere[index].load(memory_order_relaxed);
+}
+
+static void chargeOwnSlot(MemorySlot &slot, int index, int64_t bytes) {
+    slot.live_bytes[index].store(slot.live_bytes[index].load(memory_order_relaxed) + bytes, memory_order_relaxed);
+    int64_t live = netLiveBytes(slot, index);
+    if (live > slot.peak_bytes[index].load(memory_order_relaxed)) slot.peak_bytes[index].store(live, memory_order_relaxed);
+}
+#endif
+
+// Peaks restart from the bytes live now and allocation counts from zero; each slot
+// catches up at its next allocation
+void beginMemoryRun() {
+#ifndef MATERIAL_IDENTIFIER_LIBRARY
+    memory_run.fetch_add(1, memory_order_relaxed);
+#endif
+}
+
+// Live bytes add up exactly. Peaks are the sum of per-thread peaks, which is an upper
+// bound: threads rarely peak at the same moment.
+void printMemoryReport() {
+#ifdef MATERIAL_IDENTIFIER_LIBRARY
+    cout << "\nMemory accounting is not available in the library build.\n";
+#else
+    int64_t live[NUM_MEMORY_STAGES + 1] = {0}, peak[NUM_MEMORY_STAGES + 1] = {0};
+    uint64_t allocations[NUM_MEMORY_STAGES] = {0};
+    unsigned run = memory_run.load(memory_order_relaxed);
+    for (int i = 0; i < num_memory_slots; i++) {
+        const MemorySlot &slot = memory_slots[i];
+        bool current = slot.run.load(memory_order_relaxed) == run;
+        for (int index = 0; index <= memory_total; index++) {
+            int64_t slot_live = netLiveBytes(slot, index);
+            live[index] += slot_live;
+            // Slot 0 keeps no peak; an idle slot's peak this run is what it holds now
+            peak[index] += i > 0 && current ? max(slot.peak_bytes[index].load(memory_order_relaxed), slot_live) : slot_live;
+            if (index < memory_total && (i == 0 || current)) allocations[index] += slot.allocations[index].load(memory_order_relaxed);
+        }
+    }
+    
+    cout << fixed << setprecision(1);
+    cout << "\n------ MEMORY BY STAGE ------\n";
+    cout << left << setw(16) << "Stage" << right << setw(14) << "Peak KiB" << setw(14) << "Live KiB" << setw(14) << "Allocations" << "\n";
+    for (int stage = 0; stage < NUM_MEMORY_STAGES; stage++) {
+        cout << left << setw(16) << memory_stage_names[stage] << right
+             << setw(14) << peak[stage] / 1024.0
+             << setw(14) << live[stage] / 1024.0
+             << setw(14) << allocations[stage] << "\n";
+    }
+    cout << "Peak heap during run (sum of per-thread peaks): " << peak[memory_total] / 1024.0 << " KiB\n";
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        double peak_rss_kib = usage.ru_maxrss / 1024.0;  // bytes on macOS
+#else
+        double peak_rss_kib = static_cast<double>(usage.ru_maxrss);
+#endif
+        cout << "Peak RSS of the process: " << peak_rss_kib / 1024.0 << " MiB\n";
+    }
+#endif
+#endif
+}
+
+#ifndef MATERIAL_IDENTIFIER_LIBRARY
+// Each block starts with a header recording its size, stage and the slot it was charged
+// to. The header is 16 bytes so the memory handed out keeps malloc's alignment.
+struct AllocationHeader {
+    size_t size;
+    uint32_t stage;
+    uint32_t slot;
+};
+const size_t allocation_header_size = 16;
+static_assert(sizeof(AllocationHeader) <= allocation_header_size && alignof(max_align_t) <= allocation_header_size,
+              "allocation header must preserve alignment");
+
+void *operator new(size_t size) {
+    void *block;
+    while (!(block = malloc(size + allocation_header_size))) {
+        new_handler handler = get_new_handler();
+        if (!handler) throw bad_alloc();
+        handler();
+    }
+    MemoryStage stage = current_memory_stage;
+    int slot_index = threadMemorySlot();
+    AllocationHeader *header = static_cast<AllocationHeader *>(block);
+    header->size = size;
+    header->stage = stage;
+    header->slot = slot_index;
+    int64_t bytes = static_cast<int64_t>(size);
+    MemorySlot &slot = memory_slots[slot_index];
+    if (slot_index == 0) {
+        slot.live_bytes[stage].fetch_add(bytes, memory_order_relaxed);
+        slot.live_bytes[memory_total].fetch_add(bytes, memory_order_relaxed);
+        slot.allocations[stage].fetch_add(1, memory_order_relaxed);
+    } else {
+        unsigned run = memory_run.load(memory_order_relaxed);
+        if (slot.run.load(memory_order_relaxed) != run) {
+            for (int index = 0; index <= memory_total; index++) slot.peak_bytes[index].store(netLiveBytes(slot, index), memory_order_relaxed);
+            for (int index = 0; index < memory_total; index++) slot.allocations[index].store(0, memory_order_relaxed);
+            slot.run.store(run, memory_order_relaxed);
+        }
+        chargeOwnSlot(slot, stage, bytes);
+        chargeOwnSlot(slot, memory_total, bytes);
+        slot.allocations[stage].store(slot.allocations[stage].load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+    return static_cast<char *>(block) + allocation_header_size;
+}
+
+void operator delete(void *pointer) noexcept {
+    if (!pointer) return;
+    // Through uintptr_t: the compiler cannot see the header in front of the caller's object
+    void *block = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(pointer) - allocation_header_size);
+    const AllocationHeader *header = static_cast<const AllocationHeader *>(block);
+    int64_t bytes = static_cast<int64_t>(header->size);
+    MemorySlot &slot = memory_slots[header->slot];
+    if (header->slot != 0 && static_cast<int>(header->slot) == memory_lease.slot) {
+        slot.live_bytes[header->stage].store(slot.live_bytes[header->stage].load(memory_order_relaxed) - bytes, memory_order_relaxed);
+        slot.live_bytes[memory_total].store(slot.live_bytes[memory_total].load(memory_order_relaxed) - bytes, memory_order_relaxed);
+    } else {
+        slot.freed_elsewhere[header->stage].fetch_add(bytes, memory_order_relaxed);
+        slot.freed_elsewhere[memory_total].fetch_add(bytes, memory_order_relaxed);
+    }
+    free(block);
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *pointer) noexcept { operator delete(pointer); }
+
+void *operator new(size_t size, const nothrow_t &) noexcept {
+    try {
+        return operator new(size);
+    } catch (...) {
+        return 0;
+    }
+}
+void *operator new[](size_t size, const nothrow_t &) noexcept {
+    try {
+        return operator new(size);
+    } catch (...) {
+        return 0;
+    }
+}
+void operator delete(void *pointer, const nothrow_t &) noexcept { operator delete(pointer); }
+void operator delete[](void *pointer, const nothrow_t &) noexcept { operator delete(pointer); }
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void *pointer, size_t) noexcept { operator delete(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { operator delete(pointer); }
+#endif
+#endif
+
+// Materials snapshot: the database as one read-only file that is memory-mapped and used
+// in place, so startup costs the same however many materials it holds. Every reference
+// is an offset from the start of the file, so nothing is fixed up after mapping. Entries
+// are sorted by name (byte order, as in the built-in map) for binary search; names live
+// in a string table after them. Written in native byte order; a file from a machine with
+// another layout fails the byte-order or entry-size check and the built-in map is used.
+const char *const materials_snapshot_file = "materials.snap";
+const char materials_snapshot_magic[8] = {'M', 'I', 'S', 'N', 'A', 'P', 0, 1};
+
+struct MaterialSnapshotHeader {
+    char magic[8];
+    uint32_t byte_order;      // 0x01020304 as written
+    uint32_t entry_size;      // sizeof(MaterialSnapshotEntry)
+    uint64_t count;
+    uint64_t entries_offset;
+    uint64_t strings_offset;
+    uint64_t file_size;
+};
+
+struct MaterialSnapshotEntry {
+    uint32_t name_offset;     // from the start of the file
+    uint32_t name_length;
+    double area_mm2;
+    double thickness_mm;
+    double curie_temp_C;
+};
+
+struct MaterialsSnapshot {
+    const char *base;         // null when no valid snapshot is mapped
+    size_t size;
+    const MaterialSnapshotEntry *entries;
+    size_t count;
+};
+
+#ifndef MATERIAL_IDENTIFIER_LIBRARY
+// Checks the header only, which keeps opening constant-time; names are bounds-checked
+// when read
+static MaterialsSnapshot mapMaterialsSnapshot(const char *filename) {
+    MaterialsSnapshot snapshot = {0, 0, 0, 0};
+#ifdef MMAP_SUPPORTED
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return snapshot;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(MaterialSnapshotHeader)) {
+        close(fd);
+        return snapshot;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void *mapping = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return snapshot;
+    
+    const MaterialSnapshotHeader *header = static_cast<const MaterialSnapshotHeader *>(mapping);
+    bool valid = memcmp(header->magic, materials_snapshot_magic, sizeof(header->magic)) == 0 &&
+                 header->byte_order == 0x01020304 && header->entry_size == sizeof(MaterialSnapshotEntry) &&
+                 header->file_size == size && header->count > 0 &&
+                 header->entries_offset % alignof(MaterialSnapshotEntry) == 0 &&
+                 header->entries_offset >= sizeof(MaterialSnapshotHeader) && header->entries_offset <= size &&
+                 header->count <= (size - header->entries_offset) / sizeof(MaterialSnapshotEntry) &&
+                 header->strings_offset <= size;
+    if (!valid) {
+        munmap(mapping, size);
+        return snapshot;
+    }
+    // The mapping lives as long as the process
+    snapshot.base = static_cast<const char *>(mapping);
+    snapshot.size = size;
+    snapshot.entries = reinterpret_cast<const MaterialSnapshotEntry *>(snapshot.base + header->entries_offset);
+    snapshot.count = static_cast<size_t>(header->count);
+#else
+    (void)filename;
+#endif
+    return snapshot;
+}
+#endif
+
+// Mapped on first use; later snapshots are picked up at the next start. The library
+// build stays on the built-in map, so the host's working directory cannot change what
+// the C ABI returns.
+static const MaterialsSnapshot &materialsSnapshot() {
+#ifdef MATERIAL_IDENTIFIER_LIBRARY
+    static const MaterialsSnapshot snapshot = {0, 0, 0, 0};
+#else
+    static const MaterialsSnapshot snapshot = mapMaterialsSnapshot(materials_snapshot_file);
+#endif
+    return snapshot;
+}
+
+// Name of entry i in place in the mapping; empty if its offsets point outside the file
+static void snapshotName(const MaterialsSnapshot &snapshot, size_t i, const char *&name, size_t &length) {
+    const MaterialSnapshotEntry &entry = snapshot.entries[i];
+    bool inside = entry.name_offset <= snapshot.size && entry.name_length <= snapshot.size - entry.name_offset;
+    name = inside ? snapshot.base + entry.name_offset : snapshot.base;
+    length = inside ? entry.name_length : 0;
+}
+
+// Binary search of the snapshot without copying names; null if absent
+static const MaterialSnapshotEntry *findSnapshotEntry(const MaterialsSnapshot &snapshot, const char *name, size_t length) {
+    size_t low = 0, high = snapshot.count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const char *entry_name;
+        size_t entry_length;
+        snapshotName(snapshot, mid, entry_name, entry_length);
+        int order = memcmp(entry_name, name, min(entry_length, length));
+        if (order == 0) order = entry_length < length ? -1 : entry_length > length ? 1 : 0;
+        if (order == 0) return &snapshot.entries[mid];
+        if (order < 0) low = mid + 1;
+        else high = mid;
+    }
+    return 0;
+}
+
+vector<string> materialNames() {
+    vector<string> names;
+    const MaterialsSnapshot &snapshot = materialsSnapshot();
+    if (snapshot.base) {
+        for (size_t i = 0; i < snapshot.count; i++) {
+            const char *name;
+            size_t length;
+            snapshotName(snapshot, i, name, length);
+            names.push_back(string(name, length));
+        }
+        return names;
+    }
+    const map<string, Sample> &materials = builtinMaterials();
+    for (map<string, Sample>::const_iterator it = materials.begin(); it != materials.end(); ++it) names.push_back(it->first);
+    return names;
+}
+
+// Looks a material up in the snapshot if one is mapped, otherwise in the built-in map.
+// The sample comes back with no readings.
+bool findMaterial(const string &name, Sample &sample) {
+    const MaterialsSnapshot &snapshot = materialsSnapshot();
+    if (!snapshot.base) {
+        const map<string, Sample> &materials = builtinMaterials();
+        map<string, Sample>::const_iterator it = materials.find(name);
+        if (it == materials.end()) return false;
+        sample = it->second;
+        return true;
+    }
+    
+    const MaterialSnapshotEntry *entry = findSnapshotEntry(snapshot, name.data(), name.size());
+    if (!entry) return false;
+    sample.name = name;
+    sample.area_mm2 = entry->area_mm2;
+    sample.thickness_mm = entry->thickness_mm;
+    sample.curie_temp_C = entry->curie_temp_C;
+    sample.temp_capacitance_data.clear();
+    return true;
+}
+
+// findMaterial for callers that only need the Curie temperature; copies no strings, so
+// the C library can look materials up without allocating
+bool findCurieTemperature(const char *name, double &curie_temp_C) {
+    const MaterialsSnapshot &snapshot = materialsSnapshot();
+    if (snapshot.base) {
+        const MaterialSnapshotEntry *entry = findSnapshotEntry(snapshot, name, strlen(name));
+        if (!entry) return false;
+        curie_temp_C = entry->curie_temp_C;
+        return true;
+    }
+    const map<string, Sample> &materials = builtinMaterials();
+    for (map<string, Sample>::const_iterator it = materials.begin(); it != materials.end(); ++it) {
+        if (it->first.compare(name) == 0) {
+            curie_temp_C = it->second.curie_temp_C;
+            return true;
+        }
+    }
+    return false;
+}
+
+// One material per line: <area mm²> <thickness mm> <Curie T °C, -1 if none> <name>,
+// with names of at most max_material_name bytes so runs of them can be stored
+bool loadMaterialsText(const string &filename, map<string, Sample> &database) {
+    ifstream file(filename.c_str());
+    if (!file.is_open()) {
+        cout << "\nError: Could not open '" << filename << "'.\n";
+        return false;
+    }
+    string line;
+    int rejected = 0, too_long = 0;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream in(line);
+        Sample sample;
+        if (in >> sample.area_mm2 >> sample.thickness_mm >> sample.curie_temp_C && getline(in >> ws, sample.name) &&
+            sample.area_mm2 > 0 && sample.thickness_mm > 0) {
+            if (sample.name.size() > max_material_name) too_long++;
+            else database[sample.name] = sample;
+        } else {
+            rejected++;
+        }
+    }
+    if (rejected > 0) cout << rejected << " invalid material line(s) skipped.\n";
+    if (too_long > 0) cout << too_long << " material(s) with names over " << max_material_name << " bytes skipped.\n";
+    return true;
+}
+
+// Written beside the target and renamed over it, so a process that has the old
+// snapshot mapped keeps reading intact data
+bool writeMaterialsSnapshot(const string &filename, const map<string, Sample> &database) {
+    MaterialSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, materials_snapshot_magic, sizeof(header.magic));
+    header.byte_order = 0x01020304;
+    header.entry_size = sizeof(MaterialSnapshotEntry);
+    header.count = database.size();
+    header.entries_offset = sizeof(MaterialSnapshotHeader);
+    header.strings_offset = header.entries_offset + database.size() * sizeof(MaterialSnapshotEntry);
+    
+    vector<MaterialSnapshotEntry> entries;
+    string strings;
+    for (map<string, Sample>::const_iterator it = database.begin(); it != database.end(); ++it) {
+        MaterialSnapshotEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        uint64_t name_offset = header.strings_offset + strings.size();
+        if (name_offset + it->first.size() > numeric_limits<uint32_t>::max()) {
+            cout << "\nError: Database too large for a snapshot.\n";
+            return false;
+        }
+        entry.name_offset = static_cast<uint32_t>(name_offset);
+        entry.name_length = static_cast<uint32_t>(it->first.size());
+        entry.area_mm2 = it->second.area_mm2;
+        entry.thickness_mm = it->second.thickness_mm;
+        entry.curie_temp_C = it->second.curie_temp_C;
+        entries.push_back(entry);
+        strings += it->first;
+    }
+    header.file_size = header.strings_offset + strings.size();
+    
+    string temporary = filename + ".tmp";
+    {
+        ofstream out(temporary.c_str(), ios::binary | ios::trunc);
+        if (!out.is_open()) {
+            cout << "\nError: Could not create '" << temporary << "'.\n";
+            return false;
+        }
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        if (!entries.empty()) out.write(reinterpret_cast<const char *>(&entries[0]), entries.size() * sizeof(MaterialSnapshotEntry));
+        out.write(strings.data(), strings.size());
+        if (!out) {
+            cout << "\nError: Could not write '" << temporary << "'.\n";
+            return false;
+        }
+    }
+    if (rename(temporary.c_str(), filename.c_str()) != 0) {
+        cout << "\nError: Could not replace '" << filename << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+void materialsSnapshotTools() {
+    int choice;
+    cout << "1. Build snapshot from the built-in database\n2. Build snapshot from a text file\n"
+            "3. Show which database is in use\nSelect (1-3): ";
+    while (!(cin >> choice) || choice < 1 || choice > 3) {
+        cout << "Invalid selection. Please enter a number between 1 and 3: ";
+        clearInputBuffer();
+    }
+    
+    if (choice == 3) {
+        const MaterialsSnapshot &snapshot = materialsSnapshot();
+        if (snapshot.base) {
+            cout << "\nUsing the memory-mapped snapshot '" << materials_snapshot_file << "' (" << snapshot.count
+                 << " materials, " << snapshot.size << " bytes).\n";
+        } else {
+            cout << "\nNo valid '" << materials_snapshot_file << "' at startup; using the built-in database ("
+                 << builtinMaterials().size() << " materials).\n";
+        }
+        return;
+    }
+    
+    map<string, Sample> database;
+    if (choice == 1) {
+        database = builtinMaterials();
+    } else {
+        string filename;
+        cout << "Materials file (<area mm2> <thickness mm> <Curie C or -1> <name> per line): ";
+        clearInputBuffer();
+        getline(cin, filename);
+        if (!loadMaterialsText(filename, database)) return;
+        if (database.empty()) {
+            cout << "\nNo materials found in '" << filename << "'.\n";
+            return;
+        }
+    }
+    if (writeMaterialsSnapshot(materials_snapshot_file, database)) {
+        cout << "\nWrote " << database.size() << " materials to '" << materials_snapshot_file
+             << "'. It is used from the next start.\n";
+    }
+}
@@ -0,0 +1,103 @@
+/* C ABI of the dielectric and Hall analysis in "Material Identifier Project.cpp", for
+ * acquisition software that calls it in-process. Build the shared library with
+ *
+ *   g++ -std=c++11 -O2 -pthread -fPIC -shared -DMATERIAL_IDENTIFIER_LIBRARY \
+ *       "Material Identifier Project.cpp" -o libmaterialidentifier.so
+ *
+ * All arrays belong to the caller and are read or written in place; after
+ * mi_context_create nothing is allocated (except by mi_load_classifier). A context is
+ * locked for the duration of each call, so it may be shared, but giving each thread its
+ * own context avoids waiting on the lock. Functions return MI_OK or an error status;
+ * mi_last_error describes the most recent failure on that context, in a copy owned by
+ * the calling thread that stays valid until that thread calls mi_last_error again.
+ */
+#ifndef MATERIAL_IDENTIFIER_H
+#define MATERIAL_IDENTIFIER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MI_ABI_VERSION 1
+
+typedef struct mi_context mi_context;
+
+typedef enum {
+    MI_OK = 0,
+    MI_INVALID_ARGUMENT = 1,
+    MI_UNKNOWN_MATERIAL = 2,
+    MI_BUFFER_TOO_SMALL = 3,
+    MI_INVALID_CLASSIFIER = 4
+} mi_status;
+
+/* Hall classes returned by mi_classify_hall, named by mi_class_name */
+typedef enum {
+    MI_METAL = 0,
+    MI_N_TYPE = 1,
+    MI_P_TYPE = 2,
+    MI_INSULATOR = 3,
+    MI_HEAVILY_DOPED = 4
+} mi_material_class;
+
+typedef struct {
+    int peak_passed;            /* enough readings past the maximum to trust it */
+    int can_stop;               /* the sweep may be ended early */
+    int points_after_peak;
+    double peak_temp_C;
+    double peak_epsilon;
+    double predicted_curie_C;   /* parabolic refinement of the peak */
+    double uncertainty_C;       /* 1-sigma */
+    double curie_weiss_T0_C;
+    double curie_constant_K;    /* C in eps = C / (T - T0) */
+    double fit_r2;
+    double expected_curie_C;    /* from the materials database, -1 for non-ferroelectrics */
+} mi_curie_result;
+
+unsigned mi_abi_version(void);
+
+mi_context *mi_context_create(void);
+void mi_context_destroy(mi_context *context);
+const char *mi_last_error(const mi_context *context);
+
+/* Sample under test: a material from the built-in database (NULL for an unknown
+ * material) and its electrode area and thickness */
+mi_status mi_set_sample(mi_context *context, const char *material, double area_mm2, double thickness_mm);
+
+/* Prepares a raw sweep for analysis: drops invalid readings (below -273 °C or non-positive
+ * capacitance) and sorts the rest by temperature, in place. *count is updated. */
+mi_status mi_ingest_readings(mi_context *context, int *temperature_C, double *capacitance_pF, size_t *count);
+
+/* Copies the readings of one scanner channel out of an interleaved multiplexed stream,
+ * in acquisition order. *out_count is the number copied; MI_BUFFER_TOO_SMALL if more
+ * than capacity were found (the first capacity are copied). */
+mi_status mi_demultiplex_channel(mi_context *context, const int *channel, const int *temperature_C,
+                                 const double *capacitance_pF, size_t count, int wanted_channel,
+                                 int *out_temperature_C, double *out_capacitance_pF, size_t capacity,
+                                 size_t *out_count);
+
+/* epsilon[i] = capacitance_pF[i] / C0 for the current sample; the arrays may alias */
+mi_status mi_epsilon(mi_context *context, const double *capacitance_pF, size_t count, double *epsilon);
+
+/* Curie temperature analysis of a sweep sorted by temperature (see mi_ingest_readings) */
+mi_status mi_analyze_curie(mi_context *context, const int *temperature_C, const double *capacitance_pF, size_t count,
+                           mi_curie_result *result);
+
+/* Classifies count Hall measurements (densities in cm^-3, mobilities in cm^2/(V s)) into
+ * mi_material_class values */
+mi_status mi_classify_hall(mi_context *context, const double *electron_density, const double *electron_mobility,
+                           const double *hole_density, const double *hole_mobility, size_t count,
+                           unsigned char *classes);
+
+/* Replaces the context's classifier with a forest in the tree text format, NULL for the
+ * built-in one */
+mi_status mi_load_classifier(mi_context *context, const char *tree_text);
+
+const char *mi_class_name(int material_class);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MATERIAL_IDENTIFIER_H */